@@ -9,18 +9,23 @@
 
 
 #define _SOSD_MAIN_
+#define _GNU_SOURCE
+#define RING_DAEMON
 
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
@@ -31,24 +36,41 @@
 #include "NotificaThor.h"
 #include "logging.h"
 #include "images.h"
+#include "stats.h"
+#include "ring.h"
 
 
+#define CONN_TIMEOUT   1000  // ms a client may take to deliver its message
+#define CONN_MAX_FRAMES 16   // frames handled per connection and round
+#define FLUSH_INTERVAL 16    // ms between two renderings, updates arriving meanwhile are coalesced
+#define MAX_EVENTS     32
+
 static sig_atomic_t sig_received = 0;
 static int          sockfd = 0;
 static char*        socket_path;
+static thor_conn_t  *connections = NULL;      // open connections, not ordered by deadline
+static thor_conn_t  *last_connection = NULL;
+static int          backlog = 0;              // connections with frames left for the next round
+static thor_message *queue = NULL;            // messages waiting to be shown
+static int64_t      next_flush = 0;           // monotonic ms before which the queue is not shown
+static int          epfd = -1;
+static int          timerfd = -1;             // readable when the popup has timed out
+static struct epoll_event events[MAX_EVENTS]; // events of the current epoll round
+static int          nevents = 0;
+static int          headless = 0;
+static char         *dump_dir = NULL;                // headless popups are written here
 
 int xerror = 0;
 int inofd = -1;
 
 
 /*
- * Sets a timer to an amount of seconds
+ * Sets the popup timer to an amount of seconds
  * 
- * Parameters: timer   - The ID of the timer to set
- *             seconds - The time to set the timer to
+ * Parameters: seconds - The time to set the timer to
  */
  static void
-settimer( timer_t timer, double seconds)
+settimer( double seconds)
 {
 	struct itimerspec t_spec =
 	{
@@ -56,7 +78,7 @@ settimer( timer_t timer, double seconds)
 		.it_value    = { (time_t)seconds, (seconds - (time_t)seconds)*1000000000 }
 	};
 	
-	timer_settime( timer, 0, &t_spec, NULL);
+	timerfd_settime( timerfd, 0, &t_spec, NULL);
 };
 
 
@@ -81,9 +103,11 @@ print_message( thor_message *msg)
 	thor_log( LOG_DEBUG, "  Query PID = %d", msg->flags & COM_QUERY);
 	thor_log( LOG_DEBUG, "  No Image  = %d", (msg->flags & COM_NO_IMAGE) >> 1);
 	thor_log( LOG_DEBUG, "  No Bar    = %d", (msg->flags & COM_NO_BAR) >> 2);
+	thor_log( LOG_DEBUG, "  Id        = %u", msg->id);
 	thor_log( LOG_DEBUG, "  Timeout   = %f", msg->timeout);
 	thor_log( LOG_DEBUG, "  Image_len = %d", msg->image_len);
 	thor_log( LOG_DEBUG, "  Images    = \"%s\"", str_read);
+	thor_log( LOG_DEBUG, "  Image_fd  = %d (%ux%u)", msg->image_fd, msg->image_width, msg->image_height);
 	thor_log( LOG_DEBUG, "  Message   = \"%s\"", msg->message);
 	thor_log( LOG_DEBUG, "  Bar       = %d/%d", msg->bar_part, msg->bar_elements);
 	
@@ -94,81 +118,458 @@ print_message( thor_message *msg)
 
 
 /*
- * Handles a message on the NotificaThor-socket
+ * Writes a whole reply to a client. The event loop never waits for a
+ * client, so one that does not take its reply right away is cut off: its
+ * socket is shut down, later replies fail at once and the connection is
+ * dropped the next time it is read.
  * 
- * Parameters: sockfd - the filedescriptor of the socket
- *             timer  - the timer
+ * Parameters: fd  - Socket of the client.
+ *             buf - The reply.
+ *             len - Length of the reply.
  * 
  * Returns: 0 on success, -1 on error.
  */
 static int
-handle_message( int sockfd, timer_t timer)
+write_reply( int fd, const void *buf, size_t len)
 {
-	int            ret = 0;
-	fd_set         set;
-	int            clsockfd;
-	thor_message   msg = {0};
-	struct timeval timeout =
-	{
-		.tv_sec  = 1,
-		.tv_usec = 0
-	};
+	ssize_t ret;
+	
+	
+	while( len > 0 ) {
+		if( (ret = send( fd, buf, len, MSG_NOSIGNAL)) == -1 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				thor_log( LOG_ERR, "Client does not take its reply.");
+			else if( errno != EPIPE )
+				thor_errlog( LOG_ERR, "Sending reply");
+			shutdown( fd, SHUT_RDWR);
+			return -1;
+		}
+		
+		buf  = (const char*)buf + ret;
+		len -= ret;
+	}
 	
+	return 0;
+};
+
+
+/*
+ * Tells a client waiting with COM_WAIT what became of its message.
+ * 
+ * Parameters: msg    - The message.
+ *             status - COM_SHOWN, COM_REPLACED or COM_FAILED.
+ */
+static void
+send_reply( thor_message *msg, uint32_t status)
+{
+	if( msg->reply_fd == -1 )
+		return;
 	
-	/** Accepting connections **/
-	if( (clsockfd = accept( sockfd, NULL, NULL)) == -1 ) {
-		if( !sig_received )
-			thor_errlog( LOG_CRIT, "Accepting connections from socket");
-		return -1;
-	}
+	msg->reply.magic  = COM_MAGIC;
+	msg->reply.status = status;
+	write_reply( msg->reply_fd, &msg->reply, sizeof(thor_reply));
+};
+
+
+/*
+ * Appends a message to the queue of messages to be shown.
+ * A queued message with the same id is dropped, so only the
+ * latest update gets rendered.
+ * 
+ * Parameters: msg - The message to queue, the queue takes ownership.
+ */
+static void
+queue_message( thor_message *msg)
+{
+	thor_message **pos;
 	
-	/** select to introduce 1 second connection timeout **/
-	FD_ZERO( &set);
-	FD_SET( clsockfd, &set);
 	
-	switch( select( clsockfd + 1, &set, NULL, NULL, &timeout) )
-	{
-		case 0:
-			thor_log( LOG_ERR, "Connection timeout.");
-			goto end;
-		
-		case -1:
-			if( !sig_received )
-				thor_errlog( LOG_CRIT, "select()");
-			ret = -1;
-			goto end;
+	if( msg->id != 0 ) {
+		for( pos = &queue; *pos; pos = &(*pos)->next ) {
+			if( (*pos)->id == msg->id ) {
+				thor_message *old = *pos;
+				
+				
+				*pos = old->next;
+				send_reply( old, COM_REPLACED);
+				free_message( old);
+				stats.updates_coalesced++;
+				break;
+			}
+		}
 	}
 	
-	/** reading **/
-	if( receive_message( clsockfd, &msg) == -1) {
-		thor_errlog( LOG_ERR, "Receiving message");
-		goto end;
+	for( pos = &queue; *pos; pos = &(*pos)->next );
+	*pos = msg;
+};
+
+
+/*
+ * Shows all queued messages in the order they were received.
+ */
+static void
+flush_queue()
+{
+	while( queue ) {
+		thor_message *msg = queue;
+		
+		
+		queue = msg->next;
+		
+		/** initializing the popup **/
+		if( msg->timeout == 0 )
+			msg->timeout = config_osd_default_timeout;
+		
+		if( show_osd( msg) == 0 ) {
+			settimer( msg->timeout);
+			stats.messages_rendered++;
+			send_reply( msg, COM_SHOWN);
+		}
+		else
+			send_reply( msg, COM_FAILED);
+		
+		free_message( msg);
 	}
+};
+
+
+/*
+ * Handles a completely received message.
+ * 
+ * Parameters: conn - The connection the message was received on.
+ */
+static void
+handle_message( thor_conn_t *conn)
+{
+	thor_message *msg = &conn->msg;
+	thor_message *copy;
+	
 	
 #ifdef VERBOSE
 	thor_log( LOG_DEBUG, "Received message over socket:");
-	print_message( &msg);
+	print_message( msg);
 #endif /* VERBOSE */
 	
 	/** query pid **/
-	if( msg.flags & COM_QUERY ) {
+	if( msg->flags & COM_QUERY ) {
 		pid_t mypid = getpid();
-		write( clsockfd, &mypid, sizeof(pid_t));
-		goto end;
+		write_reply( conn->fd, &mypid, sizeof(pid_t));
+		return;
 	}
 	
-	/** initializing the popup **/
-	if( msg.timeout == 0 )
-		msg.timeout = config_osd_default_timeout;
+	/** query counters **/
+	if( msg->flags & COM_STATS ) {
+		char buffer[1024];
+		int  len = format_stats( buffer, sizeof(buffer));
 		
-	if( show_osd( &msg) == 0 )
-		settimer( timer, msg.timeout);
 		
-	free_message( &msg);
+		if( len < 0 )
+			return;
+		write_reply( conn->fd, buffer, ( (size_t)len < sizeof(buffer) ) ? (size_t)len : sizeof(buffer) - 1);
+		return;
+	}
 	
-  end:
-	close( clsockfd);
-	return ret;
+	/** set up a shared memory ring **/
+	if( msg->flags & COM_RING ) {
+		struct epoll_event ev = { .events = EPOLLIN };
+		
+		
+		if( conn->ring ) {
+			thor_log( LOG_ERR, "Connection already has a ring.");
+			return;
+		}
+		
+		if( (conn->ring = ring_create( conn)) == NULL )
+			return;
+		
+		ev.data.ptr = conn->ring;
+		if( epoll_ctl( epfd, EPOLL_CTL_ADD, conn->ring->efd, &ev) == -1 ||
+		    ring_send( conn->ring, conn->fd) == -1 ) {
+			thor_errlog( LOG_ERR, "Setting up ring");
+			ring_free( conn->ring);
+			conn->ring = NULL;
+		}
+		return;
+	}
+	
+	stats.messages_received++;
+	msg->reply.received = monotonic_ns();
+	if( (copy = copy_message( msg)) == NULL ) {
+		thor_errlog( LOG_ERR, "Queueing message");
+		return;
+	}
+	
+	/** the connection may be gone when the message is shown **/
+	if( copy->flags & COM_WAIT && (copy->reply_fd = fcntl( conn->fd, F_DUPFD_CLOEXEC, 0)) == -1 )
+		thor_errlog( LOG_ERR, "Keeping connection for reply");
+	
+	queue_message( copy);
+};
+
+
+/*
+ * Queues the latest update published to a ring.
+ * 
+ * Parameters: handle - The ring whose eventfd became readable.
+ */
+static void
+service_ring( ring_handle_t *handle)
+{
+	ring_entry_t entry;
+	thor_message *msg;
+	int          count;
+	
+	
+	if( (count = ring_consume( handle, &entry)) == 0 )
+		return;
+	
+	stats.ring_updates      += count;
+	stats.updates_coalesced += count - 1;
+	
+	if( (msg = (thor_message*)malloc( sizeof(thor_message))) == NULL ) {
+		thor_errlog( LOG_ERR, "Queueing ring update");
+		return;
+	}
+	memset( msg, 0, sizeof(thor_message));
+	msg->flags        = entry.flags & (COM_NO_IMAGE|COM_NO_BAR);
+	msg->id           = entry.id;
+	msg->timeout      = (double)entry.timeout / 1000;
+	msg->bar_elements = entry.bar_elements;
+	msg->bar_part     = entry.bar_part;
+	msg->image_len    = 1;
+	msg->image        = "";
+	msg->image_fd     = -1;
+	msg->reply_fd     = -1;
+	if( msg->bar_elements == 0 )
+		msg->flags |= COM_NO_BAR;
+	
+	queue_message( msg);
+};
+
+
+/*
+ * Returns the monotonic clock in milliseconds.
+ */
+static int64_t
+monotonic_ms()
+{
+	return monotonic_ns() / 1000000;
+};
+
+
+/*
+ * Unlinks a connection from the list of open connections and frees it.
+ * 
+ * Parameters: conn - The connection to drop.
+ */
+static void
+drop_connection( thor_conn_t *conn)
+{
+	int i;
+	
+	
+	/** events of this round may still point to the connection or its ring **/
+	for( i = 0; i < nevents; i++ ) {
+		if( events[i].data.ptr == conn || (conn->ring && events[i].data.ptr == conn->ring) )
+			events[i].data.ptr = NULL;
+	}
+	
+	/** the client still holds the eventfd, so it has to be removed explicitly **/
+	if( conn->ring ) {
+		epoll_ctl( epfd, EPOLL_CTL_DEL, conn->ring->efd, NULL);
+		ring_free( conn->ring);
+	}
+	if( conn->backlog )
+		backlog--;
+	
+	if( conn->prev )
+		conn->prev->next = conn->next;
+	else
+		connections = conn->next;
+	
+	if( conn->next )
+		conn->next->prev = conn->prev;
+	else
+		last_connection = conn->prev;
+	
+	conn_free( conn);
+};
+
+
+/*
+ * Accepts all pending connections on the NotificaThor-socket and
+ * registers them with epoll.
+ * 
+ * Returns: 0 on success, -1 on fatal error.
+ */
+static int
+accept_connections()
+{
+	int                clsockfd;
+	struct epoll_event ev = { .events = EPOLLIN };
+	
+	
+	while( (clsockfd = accept4( sockfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) != -1 ) {
+		thor_conn_t *conn = conn_new( clsockfd);
+		
+		
+		if( conn == NULL ) {
+			thor_errlog( LOG_ERR, "Allocating connection");
+			close( clsockfd);
+			continue;
+		}
+		
+		ev.data.ptr = conn;
+		if( epoll_ctl( epfd, EPOLL_CTL_ADD, clsockfd, &ev) == -1 ) {
+			thor_errlog( LOG_ERR, "Registering connection");
+			conn_free( conn);
+			continue;
+		}
+		
+		conn->deadline = monotonic_ms() + CONN_TIMEOUT;
+		if( connections == NULL )
+			connections = conn;
+		else {
+			conn->prev       = last_connection;
+			conn->prev->next = conn;
+		}
+		last_connection = conn;
+	}
+	
+	switch( errno ) {
+		case EAGAIN:
+	#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+	#endif
+		case ECONNABORTED:
+		case EINTR:
+			return 0;
+		
+		case EMFILE:
+		case ENFILE:
+		case ENOBUFS:
+		case ENOMEM:
+			thor_errlog( LOG_ERR, "Accepting connections from socket");
+			return 0;
+	}
+	
+	if( !sig_received )
+		thor_errlog( LOG_CRIT, "Accepting connections from socket");
+	return -1;
+};
+
+
+/*
+ * Reads from a client and handles its messages as soon as they are complete.
+ * Sessions and connections owning a ring stay open until the client hangs up.
+ * At most CONN_MAX_FRAMES are handled at once, so a fast client cannot keep
+ * the others waiting, the rest is handled by service_backlog().
+ * 
+ * Parameters: conn - The connection that became readable.
+ */
+static void
+service_connection( thor_conn_t *conn)
+{
+	int ret    = CONN_AGAIN;
+	int frames;
+	
+	
+	if( conn->backlog ) {
+		conn->backlog = 0;
+		backlog--;
+	}
+	
+	for( frames = 0; frames < CONN_MAX_FRAMES; frames++ ) {
+		int session;
+		
+		
+		if( (ret = conn_read( conn)) != CONN_DONE )
+			break;
+		
+		session = conn->msg.flags & (COM_SESSION|COM_RING);
+		handle_message( conn);
+		
+		if( !session ) {
+			drop_connection( conn);
+			return;
+		}
+		
+		conn_next( conn);
+		conn->deadline = 0;
+	}
+	
+	/** frames may wait in the buffer, where epoll does not see them **/
+	if( frames == CONN_MAX_FRAMES ) {
+		conn->backlog = 1;
+		backlog++;
+		return;
+	}
+	
+	if( ret == -1 ) {
+		if( errno != ECONNABORTED || conn_pending( conn) )
+			thor_errlog( LOG_ERR, "Receiving message");
+		drop_connection( conn);
+	}
+	/** a message has begun, the peer has to finish it in time **/
+	else if( conn->deadline == 0 && conn_pending( conn) )
+		conn->deadline = monotonic_ms() + CONN_TIMEOUT;
+};
+
+
+/*
+ * Continues every connection that had more than CONN_MAX_FRAMES to handle
+ * in the last round.
+ */
+static void
+service_backlog()
+{
+	thor_conn_t *conn = connections;
+	
+	
+	while( conn && backlog ) {
+		thor_conn_t *hlp = conn->next;
+		
+		
+		if( conn->backlog )
+			service_connection( conn);
+		conn = hlp;
+	}
+};
+
+
+/*
+ * Drops every connection that exceeded its deadline and finds the next
+ * deadline in the same pass, as the list is not ordered by deadline.
+ * Idle sessions have no deadline.
+ * 
+ * Returns: Milliseconds until the next deadline, -1 if there is none.
+ */
+static int
+expire_connections()
+{
+	int64_t     now  = monotonic_ms();
+	int64_t     next = -1;
+	thor_conn_t *conn = connections;
+	
+	
+	while( conn ) {
+		thor_conn_t *hlp = conn->next;
+		
+		
+		if( conn->deadline != 0 ) {
+			if( conn->deadline <= now ) {
+				thor_log( LOG_ERR, "Connection timeout.");
+				drop_connection( conn);
+			}
+			else if( next == -1 || conn->deadline - now < next )
+				next = conn->deadline - now;
+		}
+		conn = hlp;
+	}
+	
+	return next;
 };
 
 
@@ -184,13 +585,18 @@ sig_handler( int sig)
 
 
 /*
- * Handler for timeout.
+ * Hides the popup once the timer has expired. Runs in the event loop like
+ * show_osd(), so both never touch the windows at the same time.
  */
 static void
-timeout_handler()
+handle_timeout()
 {
+	uint64_t expirations;
+	
+	
+	if( read( timerfd, &expirations, sizeof(expirations)) == -1 )
+		return;
 	kill_osd();
-	return;
 };
 
 
@@ -204,8 +610,7 @@ event_loop()
 {
 	int                 ret        = 1;
 	struct sigaction    term_sa    = {{0}};
-	struct sigevent     ev_timeout = {{0}};
-	timer_t             timer;
+	struct epoll_event  ev         = { .events = EPOLLIN };
 	
 	
 	/** install signalhandler **/
@@ -221,62 +626,127 @@ event_loop()
 	parse_conf();
 	
 	/** install timer **/
-	ev_timeout.sigev_notify = SIGEV_THREAD;
-	ev_timeout.sigev_notify_function = timeout_handler;
-	timer_create( CLOCK_REALTIME, &ev_timeout, &timer);
+	if( (timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) == -1 ) {
+		thor_errlog( LOG_CRIT, "Creating timer");
+		goto err;
+	}
 	
 	/** prepare window **/
-	if( prepare_x() == -1 )
+	if( headless ) {
+		if( prepare_headless( dump_dir) == -1 )
+			goto err;
+	}
+	else if( prepare_x() == -1 )
 		goto err;
 	
 	parse_default_theme();
 	
-	if( listen( sockfd, 5) == -1 ) {
+	if( listen( sockfd, SOMAXCONN) == -1 ) {
 		thor_errlog( LOG_CRIT, "Listening on socket");
 		goto err_x;
 	}
 	
+	/** setup epoll **/
+	if( (epfd = epoll_create1( EPOLL_CLOEXEC)) == -1 ) {
+		thor_errlog( LOG_CRIT, "Creating epoll instance");
+		goto err_x;
+	}
+	
+	fcntl( sockfd, F_SETFL, fcntl( sockfd, F_GETFL) | O_NONBLOCK);
+	ev.data.ptr = &sockfd;
+	epoll_ctl( epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	
+	if( inofd != -1 ) {
+		ev.data.ptr = &inofd;
+		epoll_ctl( epfd, EPOLL_CTL_ADD, inofd, &ev);
+	}
+	
+	ev.data.ptr = &timerfd;
+	epoll_ctl( epfd, EPOLL_CTL_ADD, timerfd, &ev);
+	
 	load_image_cache();
 	
 	/** event loop **/
 	thor_log( LOG_DEBUG, "NotificaThor started (%d). Awaiting connections.", getpid());
 	while( 1 )
 	{
-		fd_set set;
-		int    maxfd = sockfd;
+		int i;
+		int timeout = expire_connections();
 		
 		
-		FD_ZERO( &set);
-		FD_SET( sockfd, &set);
-		if( inofd != -1 ) {
-			FD_SET( inofd, &set);
-			maxfd = ( inofd > maxfd ) ? inofd : maxfd;
+		// connections with a backlog must not wait for new input, queued messages for their flush
+		if( backlog )
+			timeout = 0;
+		else if( queue ) {
+			int64_t wait = next_flush - monotonic_ms();
+			
+			
+			if( wait < 0 )
+				wait = 0;
+			if( timeout == -1 || wait < timeout )
+				timeout = wait;
 		}
 		
-		
-		if( select( maxfd + 1, &set, NULL, NULL, NULL) == -1 ) {
+		if( (nevents = epoll_wait( epfd, events, MAX_EVENTS, timeout)) == -1 ) {
 			if( errno != EINTR )
-				thor_log( LOG_CRIT, "select()");
-			goto err_x;
+				thor_errlog( LOG_CRIT, "epoll_wait()");
+			goto err_ep;
 		}
 		
-		/** message via thor-cli **/
-		if( FD_ISSET( sockfd, &set) ) {
-			if( handle_message( sockfd, timer) == -1 )
-				goto err_x;
+		/** frames left over from the last round **/
+		service_backlog();
+		
+		for( i = 0; i < nevents; i++ ) {
+			/** dropped earlier in this round **/
+			if( events[i].data.ptr == NULL )
+				continue;
+			/** new connections via thor-cli **/
+			else if( events[i].data.ptr == &sockfd ) {
+				if( accept_connections() == -1 )
+					goto err_ep;
+			}
+			/** Inotify event **/
+			else if( events[i].data.ptr == &inofd ) {
+				thor_log( LOG_DEBUG, "Rereading config file...");
+				sleep(1);
+				close( inofd);
+				if( (inofd = inotify_init()) != -1 ) {
+					ev.data.ptr = &inofd;
+					epoll_ctl( epfd, EPOLL_CTL_ADD, inofd, &ev);
+				}
+				parse_conf();
+				parse_default_theme();
+			}
+			/** popup has timed out **/
+			else if( events[i].data.ptr == &timerfd )
+				handle_timeout();
+			/** update published to a ring **/
+			else if( *(int*)events[i].data.ptr == EV_RING )
+				service_ring( (ring_handle_t*)events[i].data.ptr);
+			/** data from a client **/
+			else
+				service_connection( (thor_conn_t*)events[i].data.ptr);
 		}
-		/** Inotify event **/
-		else if( FD_ISSET( inofd, &set) ) {
-			thor_log( LOG_DEBUG, "Rereading config file...");
-			sleep(1);
-			close( inofd);
-			inofd = inotify_init();
-			parse_conf();
-			parse_default_theme();
+		nevents = 0;
+		
+		/** render what has been received, at most once per FLUSH_INTERVAL **/
+		if( queue && monotonic_ms() >= next_flush ) {
+			flush_queue();
+			next_flush = monotonic_ms() + FLUSH_INTERVAL;
 		}
 	}
 	
 	/** cleaning up **/
+  err_ep:
+	while( connections )
+		drop_connection( connections);
+	while( queue ) {
+		thor_message *hlp = queue->next;
+		
+		free_message( queue);
+		queue = hlp;
+	}
+	close( epfd);
   err_x:
 	cleanup_x();
   err:
@@ -295,7 +765,7 @@ event_loop()
 	remove( socket_path);
 	go_up( socket_path);
 	remove( socket_path);
-	timer_delete( timer);
+	close( timerfd);
 	close_logger();
 	
 	return ret;
@@ -309,19 +779,20 @@ event_loop()
 int
 main( int argc, char *argv[])
 {
-	thor_message        query_msg = { COM_QUERY };
+	thor_header         query_msg = { COM_MAGIC, COM_VERSION, sizeof(thor_header), COM_QUERY };
 	pid_t               running_pid;
 	struct sockaddr_un  saddr;
 	char opt;
 	char *logfile       = NULL;
 	int  logging_method = 0;
 	
-	const char          optstring[] = "l:vnhV";
+	const char          optstring[] = "l:vnH::hV";
 	const struct option long_opts[] =
 	{
 		{ "logfile" , required_argument, NULL, 'l'},
 		{ "verbose" , no_argument      , NULL, 'v'},
 		{ "nodaemon", no_argument      , NULL, 'n'},
+		{ "headless", optional_argument, NULL, 'H'},
 		{ "help"    , no_argument      , NULL, 'h'},
 		{ "version" , no_argument      , NULL, 'V'},
 		{ NULL      , 0                , NULL, 0  }
@@ -345,6 +816,11 @@ main( int argc, char *argv[])
 				logging_method |= LOGGER_STDERR;
 				break;
 			
+			case 'H':
+				headless = 1;
+				dump_dir = optarg;
+				break;
+			
 			case 'h':
 				fputs( USAGE, stderr);
 				return 0;
@@ -377,7 +853,7 @@ main( int argc, char *argv[])
 		if( errno == EADDRINUSE ) {
 			if( connect( sockfd, (struct sockaddr*)&saddr, sizeof(struct sockaddr_un)) == 0 ) {
 				// socket is active
-				if( write( sockfd, &query_msg, sizeof(thor_message)) == -1 ) {
+				if( write( sockfd, &query_msg, sizeof(thor_header)) == -1 ) {
 					perror( "Sending PID query");
 					return 1;
 				}
@@ -28,6 +28,7 @@
 	"    -l, --logfile    Specify logfile to use instead of syslog.\n"\
 	"    -v, --verbose    Print debugging messages.\n"\
 	"    -n, --nodaemon   Don't fork and print debugging messages to stderr.\n"\
+	"    -H, --headless   Render without X server, --headless=DIR writes PNGs to DIR.\n"\
 	"    -h, --help       I have no idea.\n"\
 	"    -V, --version    Print version info.\n"
 
@@ -38,6 +39,7 @@ void go_up( char *string);
 char* cpycat(char* dst,char* src);
 int _parse_number( char *string, int *number, int allow_neg, char *logmsg, int line);
 #define parse_number( string, nptr, allow_neg)   _parse_number( string, nptr, allow_neg, log_msg, line)
-#define thor_realloc( ptr, type, elements)           ptr = (type*)realloc( ptr, elements*sizeof(type))
+#define thor_realloc( ptr, type, elements)           ptr = (type*)realloc( ptr, (elements)*sizeof(type))
 char *get_home_config();
 char *get_xdg_cache();
+int64_t monotonic_ns();
@@ -12,24 +12,26 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "com.h"
 
 
 /*
- * Wrapper around read(), that checks size.
+ * Wrapper around write(), that checks size.
  * 
- * Parameters: fd   - Filedescriptor to read.
- *             buf  - Pointer to buffer to read in.
- *             size - Number of bytes to read.
+ * Parameters: fd   - Filedescriptor to write to.
+ *             buf  - Pointer to buffer to write from.
+ *             size - Number of bytes to write.
  * 
  * Returns: -1 on error and sets errno, 0 on success.
  */
 static ssize_t
-read_chksize( int fd, void *buf, ssize_t size)
+write_chksize( int fd, void *buf, ssize_t size)
 {
-	ssize_t ret = read( fd, buf, size);
+	ssize_t ret = write( fd, buf, size);
 	
 	if( ret == size ) // success
 		return ret;
@@ -44,83 +46,366 @@ read_chksize( int fd, void *buf, ssize_t size)
 
 
 /*
- * Wrapper around write(), that checks size.
+ * Copies a message together with its strings into a single allocation,
+ * so it outlives the receive buffer. The copy takes over image_fd.
+ * Free it with free_message().
  * 
- * Parameters: fd   - Filedescriptor to write to.
- *             buf  - Pointer to buffer to write from.
- *             size - Number of bytes to write.
+ * Parameters: msg - The message to copy.
  * 
- * Returns: -1 on error and sets errno, 0 on success.
+ * Returns: The copy, NULL on error and sets errno. msg keeps image_fd then.
+ */
+thor_message *
+copy_message( thor_message *msg)
+{
+	thor_message *res = (thor_message*)malloc( sizeof(thor_message) + msg->image_len +
+	                                           msg->message_len);
+	char         *str;
+	
+	
+	if( res == NULL )
+		return NULL;
+	
+	str       = (char*)(res + 1);
+	*res      = *msg;
+	res->next = NULL;
+	
+	if( msg->image_len > 0 ) {
+		res->image = str;
+		memcpy( res->image, msg->image, msg->image_len);
+	}
+	if( msg->message_len > 0 ) {
+		res->message = str + msg->image_len;
+		memcpy( res->message, msg->message, msg->message_len);
+	}
+	msg->image_fd = -1;
+	msg->reply_fd = -1;
+	
+	return res;
+};
+
+
+/*
+ * Frees a message made by copy_message().
+ * 
+ * Parameters: msg - The message to free.
+ */
+void
+free_message( thor_message *msg)
+{
+	if( msg->image_fd != -1 )
+		close( msg->image_fd);
+	if( msg->reply_fd != -1 )
+		close( msg->reply_fd);
+	free( msg);
+};
+
+
+/*
+ * Allocates a new connection, that waits for its first frame.
+ * 
+ * Parameters: fd - Non-blocking filedescriptor of the client.
+ * 
+ * Returns: Pointer to the new connection, NULL on error and sets errno.
+ *          fd is not closed then.
+ */
+thor_conn_t *
+conn_new( int fd)
+{
+	thor_conn_t *conn = (thor_conn_t*)malloc( sizeof(thor_conn_t));
+	
+	
+	if( conn == NULL )
+		return NULL;
+	
+	memset( conn, 0, sizeof(thor_conn_t));
+	conn->kind   = EV_CONN;
+	conn->fd     = fd;
+	conn->size   = CONN_RECV_SIZE;
+	if( (conn->buffer = (char*)malloc( conn->size)) == NULL ) {
+		free( conn);
+		return NULL;
+	}
+	conn->msg.image_fd = -1;
+	conn->msg.reply_fd = -1;
+	
+	return conn;
+};
+
+
+/*
+ * Parses the frame at the start of the unprocessed data and sends
+ * MSG_ACK as soon as its header is complete.
+ * 
+ * Parameters: conn - The connection to parse.
+ * 
+ * Returns: CONN_DONE when conn->msg is complete, CONN_AGAIN if more data
+ *          is needed and -1 on error and sets errno.
+ */
+static int
+parse_frame( thor_conn_t *conn)
+{
+	char        *frame = conn->buffer + conn->frame;
+	size_t      avail  = conn->fill - conn->frame;
+	char        *payload;
+	char        ack    = MSG_ACK;
+	thor_header hdr    = {0};
+	
+	
+	/** header **/
+	if( avail < COM_PREFIX_LEN )
+		return CONN_AGAIN;
+	
+	memcpy( &hdr, frame, COM_PREFIX_LEN);
+	if( hdr.magic != COM_MAGIC || hdr.version == 0 || hdr.version > COM_VERSION ) {
+		errno = EBADMSG;
+		return -1;
+	}
+	
+	if( hdr.header_len < COM_HEADER_V1 || hdr.header_len > COM_HEADER_MAX ) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	
+	if( avail < hdr.header_len )
+		return CONN_AGAIN;
+	
+	// the frame is not aligned, fields beyond header_len stay zero
+	memcpy( &hdr, frame, ( hdr.header_len < sizeof(thor_header) ) ? hdr.header_len
+	                                                              : sizeof(thor_header));
+	
+	/** reject oversized frames before buffering them **/
+	if( hdr.image_len > COM_MAX_PAYLOAD || hdr.message_len > COM_MAX_PAYLOAD - hdr.image_len ) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	conn->frame_len = (size_t)hdr.header_len + hdr.image_len + hdr.message_len;
+	
+	if( !conn->acked && !(hdr.flags & (COM_SESSION|COM_NO_ACK|COM_RING)) && conn->frame_len > hdr.header_len ) {
+		if( write_chksize( conn->fd, &ack, 1) == -1 )
+			return -1;
+		conn->acked = 1;
+	}
+	
+	/** payload **/
+	if( avail < conn->frame_len )
+		return CONN_AGAIN;
+	
+	payload = frame + hdr.header_len;
+	if( (hdr.image_len   > 0 && payload[hdr.image_len - 1] != '\0') ||
+	    (hdr.message_len > 0 && payload[hdr.image_len + hdr.message_len - 1] != '\0') ) {
+		errno = EBADMSG;
+		return -1;
+	}
+	
+	/** claim the descriptor sent along with the first byte of the frame **/
+	conn->msg.image_fd = -1;
+	if( hdr.flags & COM_IMAGE_FD ) {
+		uint64_t pos = conn->base + conn->frame;
+		int      i;
+		
+		
+		for( i = 0; i < conn->nfds; i++ )
+			if( conn->fds[i].start <= pos && pos < conn->fds[i].end )
+				break;
+		
+		if( i == conn->nfds ) {
+			errno = EBADMSG;
+			return -1;
+		}
+		conn->msg.image_fd = conn->fds[i].fd;
+		memmove( conn->fds + i, conn->fds + i + 1, (--conn->nfds - i) * sizeof(conn_fd_t));
+	}
+	
+	conn->msg.flags        = hdr.flags;
+	conn->msg.id           = hdr.id;
+	conn->msg.timeout      = (double)hdr.timeout / 1000;
+	conn->msg.bar_elements = hdr.bar_elements;
+	conn->msg.bar_part     = hdr.bar_part;
+	conn->msg.image_len    = hdr.image_len;
+	conn->msg.image        = ( hdr.image_len > 0 ) ? payload : NULL;
+	conn->msg.message_len  = hdr.message_len;
+	conn->msg.message      = ( hdr.message_len > 0 ) ? payload + hdr.image_len : NULL;
+	conn->msg.image_width  = hdr.image_width;
+	conn->msg.image_height = hdr.image_height;
+	conn->msg.image_stride = hdr.image_stride;
+	
+	return CONN_DONE;
+};
+
+
+/*
+ * Reads from a client like read() and keeps descriptors sent along
+ * with the data, together with the stream positions of that data.
+ * A truncated control message or more than CONN_MAX_FDS descriptors
+ * lose descriptors, so the connection fails then.
+ * 
+ * Parameters: conn - The connection to read from.
+ * 
+ * Returns: Number of bytes read, -1 on error and sets errno.
  */
 static ssize_t
-write_chksize( int fd, void *buf, ssize_t size)
+conn_recv( thor_conn_t *conn)
 {
-	ssize_t ret = write( fd, buf, size);
+	struct iovec   iov  = { conn->buffer + conn->fill, conn->size - conn->fill };
+	struct msghdr  mhdr = {0};
+	struct cmsghdr *cmsg;
+	ssize_t        ret;
+	union
+	{
+		char           buf[CMSG_SPACE( CONN_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
 	
-	if( ret == size ) // success
-		return ret;
-	else if( ret == 0 )
-		errno = ECONNABORTED;
-	else if( ret == -1 );
-	else
+	
+	mhdr.msg_iov        = &iov;
+	mhdr.msg_iovlen     = 1;
+	mhdr.msg_control    = control.buf;
+	mhdr.msg_controllen = sizeof(control.buf);
+	
+	if( (ret = recvmsg( conn->fd, &mhdr, MSG_CMSG_CLOEXEC)) == -1 )
+		return -1;
+	
+	for( cmsg = CMSG_FIRSTHDR( &mhdr); cmsg; cmsg = CMSG_NXTHDR( &mhdr, cmsg) ) {
+		int *fds = (int*)CMSG_DATA( cmsg);
+		int i, n;
+		
+		
+		if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+			continue;
+		
+		n = (cmsg->cmsg_len - CMSG_LEN( 0)) / sizeof(int);
+		for( i = 0; i < n; i++ ) {
+			if( conn->nfds < CONN_MAX_FDS && !(mhdr.msg_flags & MSG_CTRUNC) ) {
+				conn->fds[conn->nfds].fd    = fds[i];
+				conn->fds[conn->nfds].start = conn->base + conn->fill;
+				conn->fds[conn->nfds].end   = conn->base + conn->fill + ret;
+				conn->nfds++;
+			}
+			else {
+				close( fds[i]);
+				mhdr.msg_flags |= MSG_CTRUNC;
+			}
+		}
+	}
+	
+	if( mhdr.msg_flags & MSG_CTRUNC ) {
 		errno = EBADMSG;
+		return -1;
+	}
 	
-	return -1;
+	return ret;
 };
 
 
 /*
- * Reads a message from filedescriptor.
+ * Reads everything the client has sent so far into the receive buffer
+ * until a complete frame is available. Never blocks.
  * 
- * Parameters: fd  - Filedescriptor to communicate with.
- *             msg - Pointer to message struct.
+ * Parameters: conn - The connection to read from.
  * 
- * Returns: 0 on success, -1 on error.
+ * Returns: CONN_DONE when conn->msg is complete, CONN_AGAIN if more data
+ *          is needed and -1 on error or EOF and sets errno.
  */
 int
-receive_message( int fd, thor_message *msg)
+conn_read( thor_conn_t *conn)
 {
-	ssize_t len = 0;
-	char *buffer;
-	char ack = MSG_ACK;
+	ssize_t ret;
 	
-	/** get struct **/
-	if( read_chksize( fd, msg, sizeof(thor_message)) == -1 )
-		return -1;
+	
+	while( (ret = parse_frame( conn)) == CONN_AGAIN ) {
+		/** move unprocessed data to the front **/
+		if( conn->frame > 0 ) {
+			memmove( conn->buffer, conn->buffer + conn->frame, conn->fill - conn->frame);
+			conn->base += conn->frame;
+			conn->fill -= conn->frame;
+			conn->frame = 0;
+		}
 		
-	len = msg->image_len + msg->message_len;
-	if( len > 0 ) {
-		if( write_chksize( fd, &ack, 1) == -1 )
-			return -1;
+		/** grow buffer to hold the whole frame **/
+		if( conn->fill == conn->size || conn->frame_len > conn->size ) {
+			size_t newsize = ( conn->frame_len > conn->size ) ? conn->frame_len : 2 * conn->size;
+			char   *hlp    = (char*)realloc( conn->buffer, newsize);
+			
 			
-		buffer = (char*)malloc( len);
+			if( hlp == NULL ) {
+				errno = ENOMEM;
+				return -1;
+			}
+			conn->buffer = hlp;
+			conn->size   = newsize;
+		}
 		
-		if( read_chksize( fd, buffer, len) == -1 )
-			goto err;
+		ret = conn_recv( conn);
+		if( ret == -1 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				return CONN_AGAIN;
+			return -1;
+		}
+		else if( ret == 0 ) {
+			errno = ECONNABORTED;
+			return -1;
+		}
 		
-		msg->image = buffer;
-		if( msg->message_len > 0 )
-			msg->message = buffer + msg->image_len;
+		conn->fill += ret;
 	}
 	
-	return 0;
-	
-  err:
-	free( buffer);
-	return -1;
+	return ret;
 };
 
 
 /*
- * Frees message struct.
+ * Discards the frame that has been handled and prepares the connection
+ * for the next frame of a session. Descriptors, that came with no byte
+ * of a later frame, belonged to a frame without COM_IMAGE_FD and are closed.
  * 
- * Parameters: msg - Pointer to message to free.
+ * Parameters: conn - The connection to advance.
  */
 void
-free_message( thor_message *msg)
+conn_next( thor_conn_t *conn)
 {
-	if( msg->image_len > 0 || msg->message_len)
-		free( msg->image);
+	int i, kept = 0;
+	
 	
-	return;
+	conn->frame    += conn->frame_len;
+	conn->frame_len = 0;
+	conn->acked     = 0;
+	if( conn->msg.image_fd != -1 )
+		close( conn->msg.image_fd);
+	memset( &conn->msg, 0, sizeof(thor_message));
+	conn->msg.image_fd = -1;
+	conn->msg.reply_fd = -1;
+	
+	for( i = 0; i < conn->nfds; i++ ) {
+		if( conn->fds[i].end <= conn->base + conn->frame )
+			close( conn->fds[i].fd);
+		else
+			conn->fds[kept++] = conn->fds[i];
+	}
+	conn->nfds = kept;
+	
+	if( conn->frame == conn->fill ) {
+		conn->base += conn->fill;
+		conn->frame = 0;
+		conn->fill  = 0;
+	}
+};
+
+
+/*
+ * Closes a connection and frees it.
+ * 
+ * Parameters: conn - The connection to free.
+ */
+void
+conn_free( thor_conn_t *conn)
+{
+	if( conn->msg.image_fd != -1 )
+		close( conn->msg.image_fd);
+	while( conn->nfds > 0 )
+		close( conn->fds[--conn->nfds].fd);
+	close( conn->fd);
+	free( conn->buffer);
+	free( conn);
 };
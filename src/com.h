@@ -12,13 +12,110 @@
 #define MSG_ACK  6
 
 
-/***** sosd_message struct *****/
+/*
+ * Wire format
+ * 
+ * Every message is a frame made of a thor_header directly followed by
+ * image_len bytes of NUL-separated image filenames and message_len bytes
+ * of NUL-terminated message text. All fields are fixed-width and in host
+ * byte order.
+ * 
+ * header_len is the size of the header as known to the sender. New fields
+ * are only ever appended, so a daemon reads what it knows and skips the
+ * rest, and fields missing from an older client read as zero.
+ * 
+ * COM_QUERY and COM_STATS are answered with the PID and with the
+ * counters (see stats.h) as text, respectively.
+ * 
+ * A client sends the header, waits for MSG_ACK and then sends the payload.
+ * If COM_NO_ACK is set, no MSG_ACK is sent and the client writes the
+ * whole frame at once. Frames exceeding COM_HEADER_MAX or COM_MAX_PAYLOAD
+ * are rejected as soon as the header has been read.
+ * 
+ * If COM_SESSION is set, no MSG_ACK is sent either and the connection stays
+ * open after the message has been handled, so the client can stream
+ * further frames back to back. They are handled in the order they were sent.
+ * 
+ * COM_RING asks for a shared memory ring for bar updates instead, see ring.h.
+ * 
+ * With COM_IMAGE_FD the frame is sent with sendmsg() and carries a sealed
+ * memfd (SCM_RIGHTS) along with its first byte. Descriptors sent with any
+ * other frame are closed. The memfd holds image_height rows of image_stride
+ * bytes of premultiplied ARGB32 pixels in native byte order. It must be
+ * sealed with at least F_SEAL_SHRINK and F_SEAL_WRITE. It takes the place
+ * of the first image filename.
+ * 
+ * With COM_WAIT the daemon answers with a thor_reply as soon as the message
+ * has been drawn, replaced by a newer one with the same id or rejected.
+ * Replies are sent in the order the messages are handled.
+ */
+#define COM_MAGIC       0x524f4854      // "THOR"
+#define COM_VERSION     1
+
 typedef struct
 {
+	uint32_t     magic;
+	uint16_t     version;
+	uint16_t     header_len;
+	
 	#define COM_QUERY    (1 << 0)
 	#define COM_NO_IMAGE (1 << 1)
 	#define COM_NO_BAR   (1 << 2)
+	#define COM_SESSION  (1 << 3)
+	#define COM_NO_ACK   (1 << 4)
+	#define COM_STATS    (1 << 5)
+	#define COM_RING     (1 << 6)
+	#define COM_IMAGE_FD (1 << 7)
+	#define COM_WAIT     (1 << 8)
+	uint32_t     flags;
+	uint32_t     timeout;       // milliseconds, 0 for default
+	uint32_t     bar_elements;
+	uint32_t     bar_part;
+	uint32_t     image_len;
+	uint32_t     message_len;
+	
+	/** header_len >= 36 **/
+	uint32_t     id;            // a newer update with the same id replaces a queued one, 0 for none
+	
+	/** header_len >= 48 **/
+	uint32_t     image_width;   // dimensions of the COM_IMAGE_FD image
+	uint32_t     image_height;
+	uint32_t     image_stride;
+} thor_header;
+
+typedef struct
+{
+	uint32_t     magic;         // COM_MAGIC
+	
+	#define COM_SHOWN    0
+	#define COM_REPLACED 1
+	#define COM_FAILED   2
+	uint32_t     status;
+	
+	/** CLOCK_MONOTONIC in nanoseconds, 0 if the stage was not reached **/
+	uint64_t     received;      // frame has been read completely
+	uint64_t     layout;        // geometry has been computed
+	uint64_t     raster;        // popup has been drawn off-screen
+	uint64_t     presented;     // popup has been copied to the window and flushed
+} thor_reply;
+
+#define COM_PREFIX_LEN  8               // magic, version and header_len
+#define COM_HEADER_V1   32              // smallest header_len accepted
+#define COM_HEADER_MAX  256             // largest header_len accepted
+#define COM_MAX_PAYLOAD 65536           // largest image_len + message_len accepted
+
+
+/***** sosd_message struct *****/
+/*
+ * Daemon-side view of a received frame. The strings point into
+ * the receive buffer of the connection, or directly behind the struct
+ * for a copy made by copy_message(). image_fd and reply_fd are owned
+ * by the message.
+ */
+typedef struct thor_message_
+{
 	uint32_t     flags;
+	uint32_t     id;
 	double       timeout;
 	ssize_t      image_len;
 	char         *image;
@@ -26,9 +123,65 @@ typedef struct
 	char         *message;
 	unsigned int bar_elements;
 	unsigned int bar_part;
+	int          image_fd;      // memfd of the COM_IMAGE_FD image, -1 if none
+	unsigned int image_width;
+	unsigned int image_height;
+	unsigned int image_stride;
+	int          reply_fd;      // socket to send the thor_reply to, -1 if none
+	thor_reply   reply;
+	
+	struct thor_message_ *next;  // queue of messages waiting to be shown
 } thor_message;
 
 
+/***** connection state machine *****/
+#define CONN_MAX_FDS  4                 // descriptors buffered per connection
+
+typedef struct
+{
+	int                fd;
+	uint64_t           start;       // stream positions of the bytes received along with fd
+	uint64_t           end;
+} conn_fd_t;
+
+#define EV_CONN  1                      // kinds of objects registered with epoll
+#define EV_RING  2
+
+typedef struct thor_conn_
+{
+	int                kind;        // EV_CONN, must be first
+	int                fd;
+	thor_message       msg;         // valid after conn_read() returned CONN_DONE
+	
+	char               *buffer;     // receive buffer, frames are parsed in place
+	size_t             size;        // allocated size of buffer
+	size_t             fill;        // bytes received into buffer
+	uint64_t           base;        // stream position of the start of buffer
+	size_t             frame;       // offset of the current frame
+	size_t             frame_len;   // length of the current frame, 0 if header is incomplete
+	int                acked;       // MSG_ACK has been sent for the current frame
+	conn_fd_t          fds[CONN_MAX_FDS];  // received descriptors not yet claimed by a frame
+	int                nfds;
+	int64_t            deadline;    // monotonic ms after which the peer is dropped, 0 if idle
+	int                backlog;     // buffered frames are left for the next round
+	struct ring_handle_ *ring;      // ring requested with COM_RING, NULL if none
+	
+	struct thor_conn_  *prev;
+	struct thor_conn_  *next;
+} thor_conn_t;
+
+#define CONN_AGAIN     0
+#define CONN_DONE      1
+#define CONN_RECV_SIZE 4096             // initial size of the receive buffer
+
+#define conn_pending( conn)   ((conn)->fill > (conn)->frame)
+
+
 /***** functions *****/
-int  receive_message( int fd, thor_message *msg);
-void free_message( thor_message *msg);
+thor_message *copy_message( thor_message *msg);
+void         free_message( thor_message *msg);
+
+thor_conn_t *conn_new( int fd);
+int         conn_read( thor_conn_t *conn);
+void        conn_next( thor_conn_t *conn);
+void        conn_free( thor_conn_t *conn);
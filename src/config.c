@@ -32,6 +32,9 @@ coord_t       config_osd_default_x                    = {0, 0};
 coord_t       config_osd_default_y                    = {0, 0};
 int           config_use_argb                         = 1;
 int           config_use_xshape                       = 0;
+int           config_use_mitshm                       = 1;
+int           config_keep_mapped                      = 0;
+int           config_osd_monitor                      = OSD_MONITOR_PRIMARY;
 char          config_default_font[MAX_FONT_LEN + 1]   = CONFIG_DEFAULT_FONT;
 
 
@@ -139,6 +142,8 @@ print_config()
 {
 	thor_log( LOG_DEBUG, "  use_argb            = %d", config_use_argb);
 	thor_log( LOG_DEBUG, "  use_xshape          = %d", config_use_xshape);
+	thor_log( LOG_DEBUG, "  use_mitshm          = %d", config_use_mitshm);
+	thor_log( LOG_DEBUG, "  keep_mapped         = %d", config_keep_mapped);
 	thor_log( LOG_DEBUG, "  default_theme       = \"%s\"", config_default_theme);
 	thor_log( LOG_DEBUG, "  default_font        = \"%s\"", config_default_font);
 	thor_log( LOG_DEBUG, "  osd_default_timeout = %f", config_osd_default_timeout);
@@ -146,6 +151,7 @@ print_config()
 	                                                             config_osd_default_x.abs_flag);
 	thor_log( LOG_DEBUG, "  osd_default_y       = %d, abs = %d", config_osd_default_y.coord,
 	                                                             config_osd_default_y.abs_flag);
+	thor_log( LOG_DEBUG, "  osd_monitor         = %d", config_osd_monitor);
 };
 #endif /* VERBOSE */
 
@@ -232,6 +238,10 @@ parse_conf()
 			else
 				parse_bool( value, &config_use_xshape);
 		}
+		else if( strcmp( key, "use_mitshm") == 0 )
+			parse_bool( value, &config_use_mitshm);
+		else if( strcmp( key, "keep_mapped") == 0 )
+			parse_bool( value, &config_keep_mapped);
 		else if( strcmp( key, "default_theme") == 0 )
 			strncpy( config_default_theme, value, MAX_THEME_LEN);
 		else if( strcmp( key, "default_font") == 0 )
@@ -249,6 +259,14 @@ parse_conf()
 			parse_coord( value, &config_osd_default_x);
 		else if( strcmp( key, "osd_default_y") == 0 )
 			parse_coord( value, &config_osd_default_y);
+		else if( strcmp( key, "osd_monitor") == 0 ) {
+			if( strcmp( value, "primary") == 0 )
+				config_osd_monitor = OSD_MONITOR_PRIMARY;
+			else if( strcmp( value, "all") == 0 )
+				config_osd_monitor = OSD_MONITOR_ALL;
+			else
+				parse_number( value, &config_osd_monitor, 0);
+		}
 		else {
 			thor_log( LOG_ERR, "%s%d - unknown key '%s'.", log_msg, line, key);
 		}
@@ -28,6 +28,11 @@ extern coord_t config_osd_default_x;
 extern coord_t config_osd_default_y;
 extern int     config_use_argb;
 extern int     config_use_xshape;
+extern int     config_use_mitshm;
+extern int     config_keep_mapped;
+#define OSD_MONITOR_PRIMARY  -1
+#define OSD_MONITOR_ALL      -2
+extern int     config_osd_monitor;
 #define MAX_FONT_LEN 64
 extern char    config_default_font[];
 	
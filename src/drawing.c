@@ -26,8 +26,9 @@
 #include "images.h"
 
 
-struct fbs_t fallback_surface;
-char         *image_string;
+struct fbs_t    fallback_surface;
+char            *image_string;
+cairo_pattern_t *image_raw;
 
 /*
  * Draws a rectangle with rounded corners.
@@ -205,8 +206,13 @@ set_layer( cairo_t *cr, layer_t *layer)
 	cairo_status_t  status;
 	
 	
+	/** raw image sent by the client takes the first empty png pattern **/
+	if( layer->pattern == NULL && image_raw ) {
+		pat       = image_raw;
+		image_raw = NULL;
+	}
 	/** empty png pattern **/
-	if( layer->pattern == NULL ) {
+	else if( layer->pattern == NULL ) {
 		if( !image_string || !*image_string )
 			return -1;
 		
@@ -272,13 +278,177 @@ draw_surface( cairo_t *cr, surface_t *surface, int control,
 };
 
 
+/*
+ * Strokes the border of a surface.
+ * 
+ * Parameters: cr            - Cairo context, translated to the origin of the border.
+ *             surface       - Surface structure.
+ *             width, height - Extents of the border.
+ */
+static void
+stroke_border( cairo_t *cr, surface_t *surface, double width, double height)
+{
+	cairo_pattern_t *bmap = NULL;
+	double          snap = (double)surface->border.width / 2;
+	
+	
+	cairo_rounded_rectangle( cr, snap, snap,
+								 width - surface->border.width, height - surface->border.width,
+								 surface->rad_tl - snap, surface->rad_tr - snap,
+								 surface->rad_br - snap, surface->rad_bl - snap);
+	
+	switch( surface->border.type ) {
+		case BORDER_TYPE_SOLID:
+			bmap = cairo_pattern_create_rgba( cairo_rgba( surface->border.color));
+			break;
+		
+		case BORDER_TYPE_TOPLEFT:
+			bmap = bordermap( surface, -0.5, 0, width, height, surface->border.topcolor, surface->border.color,
+							  surface->border.color, surface->border.topcolor);
+			break;
+		
+		case BORDER_TYPE_TOPRIGHT:
+			bmap = bordermap( surface, 0, 0, width, height, surface->border.topcolor, surface->border.topcolor,
+							  surface->border.color, surface->border.color);
+			break;
+	}
+	
+	cairo_set_line_width( cr, surface->border.width);
+	cairo_set_operator( cr, surface->border.operator);
+	cairo_set_source( cr, bmap);
+	cairo_stroke( cr);
+	
+	cairo_pattern_destroy( bmap);
+};
+
+
+/*
+ * Gets the size of the corners of a border sprite. Everything between the
+ * corners is the same along the side, so one pixel is enough.
+ * 
+ * Parameters: surface - Surface structure.
+ *             slice   - Pointer to where left, top, right and bottom are stored.
+ */
+static void
+sprite_slices( surface_t *surface, int *slice)
+{
+	#define max3( a, b, c)  ( (a) > (b) ? ((a) > (c) ? (a) : (c)) : ((b) > (c) ? (b) : (c)) )
+	// one more pixel for antialiasing
+	slice[0] = max3( surface->rad_tl, surface->rad_bl, surface->border.width) + 1;
+	slice[1] = max3( surface->rad_tl, surface->rad_tr, surface->border.width) + 1;
+	slice[2] = max3( surface->rad_tr, surface->rad_br, surface->border.width) + 1;
+	slice[3] = max3( surface->rad_bl, surface->rad_br, surface->border.width) + 1;
+	#undef max3
+};
+
+
+/*
+ * Renders a split border once into a 9-slice sprite. Mesh patterns are
+ * slow, so they are not built for every popup.
+ * 
+ * Parameters: surface - Surface structure.
+ *             slice   - Corner sizes from sprite_slices().
+ * 
+ * Returns: Pattern of the sprite.
+ */
+static cairo_pattern_t *
+border_sprite( surface_t *surface, int *slice)
+{
+	if( surface->border.sprite == NULL ) {
+		int             width  = slice[0] + 1 + slice[2];
+		int             height = slice[1] + 1 + slice[3];
+		cairo_surface_t *surf  = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, width, height);
+		cairo_t         *cr    = cairo_create( surf);
+		
+		
+		// draw_surface() or draw_border() clip to the same shape
+		cairo_rounded_rectangle( cr, 0, 0, width, height, surface->rad_tl, surface->rad_tr,
+		                         surface->rad_br, surface->rad_bl);
+		cairo_clip( cr);
+		stroke_border( cr, surface, width, height);
+		cairo_destroy( cr);
+		
+		surface->border.sprite = cairo_pattern_create_for_surface( surf);
+		cairo_pattern_set_extend( surface->border.sprite, CAIRO_EXTEND_PAD);
+		cairo_pattern_set_filter( surface->border.sprite, CAIRO_FILTER_NEAREST);
+		cairo_surface_destroy( surf);
+	}
+	
+	return surface->border.sprite;
+};
+
+
+/*
+ * Copies a part of a sprite, stretched to the target rectangle.
+ * 
+ * Parameters: cr             - Cairo context.
+ *             sprite         - Pattern of the sprite.
+ *             sx, sy, sw, sh - Part of the sprite.
+ *             x, y, w, h     - Target rectangle.
+ */
+static void
+blit_slice( cairo_t *cr, cairo_pattern_t *sprite, double sx, double sy, double sw, double sh,
+            double x, double y, double w, double h)
+{
+	cairo_matrix_t matrix;
+	
+	
+	if( w <= 0 || h <= 0 )
+		return;
+	
+	cairo_matrix_init_translate( &matrix, sx, sy);
+	cairo_matrix_scale( &matrix, sw / w, sh / h);
+	cairo_matrix_translate( &matrix, -x, -y);
+	cairo_pattern_set_matrix( sprite, &matrix);
+	
+	cairo_rectangle( cr, x, y, w, h);
+	cairo_fill( cr);
+};
+
+
+/*
+ * Draws a split border from its sprite.
+ * 
+ * Parameters: cr            - Cairo context.
+ *             surface       - Surface structure.
+ *             slice         - Corner sizes from sprite_slices().
+ *             x, y,
+ *             width, height - Coordinates of the border.
+ */
+static void
+blit_border( cairo_t *cr, surface_t *surface, int *slice,
+             double x, double y, double width, double height)
+{
+	cairo_pattern_t *sprite = border_sprite( surface, slice);
+	double          sx[3]   = { 0, slice[0], slice[0] + 1 };
+	double          sw[3]   = { slice[0], 1, slice[2] };
+	double          sy[3]   = { 0, slice[1], slice[1] + 1 };
+	double          sh[3]   = { slice[1], 1, slice[3] };
+	double          dx[3]   = { x, x + slice[0], x + width - slice[2] };
+	double          dw[3]   = { slice[0], width - slice[0] - slice[2], slice[2] };
+	double          dy[3]   = { y, y + slice[1], y + height - slice[3] };
+	double          dh[3]   = { slice[1], height - slice[1] - slice[3], slice[3] };
+	int             i, j;
+	
+	
+	cairo_new_path( cr);
+	cairo_set_operator( cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source( cr, sprite);
+	for( j = 0; j < 3; j++ )
+		for( i = 0; i < 3; i++ )
+			if( i == 1 && j == 1 )     // inside of the border is empty
+				continue;
+			else
+				blit_slice( cr, sprite, sx[i], sy[j], sw[i], sh[j], dx[i], dy[j], dw[i], dh[j]);
+};
+
+
 void
 draw_border( cairo_t *cr, surface_t *surface, int outer,
              double x, double y, double width, double height)
 {
 	if( surface->border.width > 0 ) {
-		cairo_pattern_t *bmap = NULL;
-		double          snap = (double)surface->border.width / 2;
+		int slice[4];
 		
 		
 		if( outer ) {
@@ -293,35 +463,17 @@ draw_border( cairo_t *cr, surface_t *surface, int outer,
 			cairo_clip( cr);
 		}
 		
-		cairo_translate( cr, x, y);
-		cairo_rounded_rectangle( cr, snap, snap,
-									 width - surface->border.width, height - surface->border.width,
-									 surface->rad_tl - snap, surface->rad_tr - snap,
-									 surface->rad_br - snap, surface->rad_bl - snap);
+		sprite_slices( surface, slice);
 		
-		switch( surface->border.type ) {
-			case BORDER_TYPE_SOLID:
-				bmap = cairo_pattern_create_rgba( cairo_rgba( surface->border.color));
-				break;
-			
-			case BORDER_TYPE_TOPLEFT:
-				bmap = bordermap( surface, -0.5, 0, width, height, surface->border.topcolor, surface->border.color,
-								  surface->border.color, surface->border.topcolor);
-				break;
-			
-			case BORDER_TYPE_TOPRIGHT:
-				bmap = bordermap( surface, 0, 0, width, height, surface->border.topcolor, surface->border.topcolor,
-								  surface->border.color, surface->border.color);
-				break;
+		/** split borders come from a sprite, if it fits and blends as it was drawn **/
+		if( surface->border.type != BORDER_TYPE_SOLID && surface->border.operator == CAIRO_OPERATOR_OVER &&
+		    width >= slice[0] + slice[2] && height >= slice[1] + slice[3] )
+			blit_border( cr, surface, slice, x, y, width, height);
+		else {
+			cairo_translate( cr, x, y);
+			stroke_border( cr, surface, width, height);
+			cairo_identity_matrix( cr);
 		}
-		
-		cairo_set_line_width( cr, surface->border.width);
-		cairo_set_operator( cr, surface->border.operator);
-		cairo_set_source( cr, bmap);
-		cairo_stroke( cr);
-		
-		cairo_pattern_destroy( bmap);
-		cairo_identity_matrix( cr);
 	}
 	
 	cairo_reset_clip( cr);
@@ -13,8 +13,9 @@ struct fbs_t
 	cairo_operator_t surf_op;
 };
 
-extern struct fbs_t fallback_surface;
-extern char         *image_string;
+extern struct fbs_t    fallback_surface;
+extern char            *image_string;
+extern cairo_pattern_t *image_raw;      // pattern for the COM_IMAGE_FD image of the current message
 
 
 #define CONTROL_NONE             0
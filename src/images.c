@@ -7,12 +7,19 @@
  * Description: Functions regarding image files.                 *
 \* ************************************************************* */
 
+#define _GNU_SOURCE
+
 #include <cairo/cairo.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cairo_guards.h"
 #include "NotificaThor.h"
@@ -21,22 +28,58 @@
 
 
 #define IMAGE_CACHE_SIZE   32
+#define IMAGE_RAW_MAX      4096  // largest width and height of a raw image
 
 typedef struct
 {
 	int             used;
 	cairo_pattern_t *pattern;
 	char            filename[FILENAME_MAX];
+	image_stamp_t   stamp;          // file the pattern was created from
 } image_cache_t;
 
+typedef struct
+{
+	void   *addr;
+	size_t len;
+} image_map_t;
+
 static image_cache_t image_cache[IMAGE_CACHE_SIZE] = {{0}};
 static int           next_im_cache = 0;
+static const cairo_user_data_key_t image_map_key;
 
 char image_cache_path[FILENAME_MAX];
 
 
+/*
+ * Identifies the content of an image file by modification time and size,
+ * so a file rewritten at the same path is told apart.
+ * 
+ * Parameters: filename - The path to the file.
+ *             stamp    - Pointer to where the stamp is stored, zeroed on error.
+ * 
+ * Returns: 0 on success, -1 if the file cannot be stat'ed.
+ */
+int
+image_stamp( const char *filename, image_stamp_t *stamp)
+{
+	struct stat st;
+	
+	
+	memset( stamp, 0, sizeof(image_stamp_t));
+	if( stat( filename, &st) == -1 )
+		return -1;
+	
+	stamp->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	stamp->size     = st.st_size;
+	
+	return 0;
+};
+
+
 /*
  * Search for the given filename in the image ringbuffer or create a new pattern.
+ * A cached pattern is created again, if the file has changed since.
  * 
  * Parameters: filename - The path to the PNG-file.
  * 
@@ -46,23 +89,34 @@ cairo_pattern_t *
 get_pattern_for_png( char *filename)
 {
 	int             i;
+	int             slot = next_im_cache;
 	cairo_surface_t *surface;
 	cairo_pattern_t *pattern;
 	cairo_matrix_t  scaling;
+	image_stamp_t   stamp;
+	
+	
+	image_stamp( filename, &stamp);
 	
 	/** search for surface to be already present **/
 	for( i = 0; i < IMAGE_CACHE_SIZE && image_cache[i].used == 1; i++ ) {
 		if( strcmp( image_cache[i].filename, filename) == 0 ) {
+			if( memcmp( &image_cache[i].stamp, &stamp, sizeof(image_stamp_t)) == 0 ) {
 #ifdef VERBOSE
-			thor_log( LOG_DEBUG, "Found '%s' in image_cache[%d]...", filename, i);
+				thor_log( LOG_DEBUG, "Found '%s' in image_cache[%d]...", filename, i);
 #endif /* VERBOSE */
-			return image_cache[i].pattern;
+				return image_cache[i].pattern;
+			}
+			
+			// file has been rewritten, replace the entry in place
+			slot = i;
+			break;
 		}
 	}
 	
 	/** otherwise create it **/
 #ifdef VERBOSE
-	thor_log( LOG_DEBUG, "Creating pattern for '%s' in image_cache[%d]...", filename, next_im_cache);
+	thor_log( LOG_DEBUG, "Creating pattern for '%s' in image_cache[%d]...", filename, slot);
 #endif /* VERBOSE */
 	surface = cairo_image_surface_create_from_png( filename);
 	pattern = cairo_pattern_create_for_surface( surface);
@@ -76,21 +130,105 @@ get_pattern_for_png( char *filename)
 	cairo_pattern_set_matrix( pattern, &scaling);
 	cairo_surface_destroy( surface);
 	
-	if( image_cache[next_im_cache].used == 1 )
-		cairo_pattern_destroy( image_cache[next_im_cache].pattern);
+	if( image_cache[slot].used == 1 )
+		cairo_pattern_destroy( image_cache[slot].pattern);
 	
-	image_cache[next_im_cache].used = 1;
-	image_cache[next_im_cache].pattern = pattern;
-	cpycat( image_cache[next_im_cache].filename, filename);
+	image_cache[slot].used = 1;
+	image_cache[slot].pattern = pattern;
+	image_cache[slot].stamp   = stamp;
+	cpycat( image_cache[slot].filename, filename);
 	
-	next_im_cache++;
-	if( next_im_cache == IMAGE_CACHE_SIZE )
+	if( slot == next_im_cache && ++next_im_cache == IMAGE_CACHE_SIZE )
 		next_im_cache = 0;
 	
 	return pattern;
 };
 
 
+/*
+ * Unmaps the pixels of a surface created by get_pattern_for_memfd().
+ */
+static void
+unmap_image( void *data)
+{
+	image_map_t *map = (image_map_t*)data;
+	
+	
+	munmap( map->addr, map->len);
+	free( map);
+};
+
+
+/*
+ * Maps a sealed memfd holding premultiplied ARGB32 pixels and wraps it
+ * into a pattern without copying. The mapping lives as long as the pattern.
+ * 
+ * Parameters: fd            - The memfd, still owned by the caller.
+ *             width, height - Dimensions of the image.
+ *             stride        - Bytes per row.
+ * 
+ * Returns: cairo_pattern_t* for the image, NULL on error.
+ */
+cairo_pattern_t *
+get_pattern_for_memfd( int fd, unsigned int width, unsigned int height, unsigned int stride)
+{
+	int             seals;
+	struct stat     st;
+	image_map_t     *map;
+	cairo_surface_t *surface;
+	cairo_pattern_t *pattern;
+	cairo_matrix_t  scaling;
+	
+	
+	if( width == 0 || height == 0 || width > IMAGE_RAW_MAX || height > IMAGE_RAW_MAX ||
+	    stride % 4 != 0 || stride < (unsigned int)cairo_format_stride_for_width( CAIRO_FORMAT_ARGB32, width) ) {
+		thor_log( LOG_ERR, "Invalid raw image %ux%u, stride %u.", width, height, stride);
+		return NULL;
+	}
+	
+	/** the client must not be able to change or truncate the pixels **/
+	seals = fcntl( fd, F_GET_SEALS);
+	if( seals == -1 || (seals & (F_SEAL_SHRINK|F_SEAL_WRITE)) != (F_SEAL_SHRINK|F_SEAL_WRITE) ) {
+		thor_log( LOG_ERR, "Raw image is not a sealed memfd.");
+		return NULL;
+	}
+	
+	if( fstat( fd, &st) == -1 || st.st_size < (off_t)stride * height ) {
+		thor_log( LOG_ERR, "Raw image is smaller than %ux%u.", width, height);
+		return NULL;
+	}
+	
+	map      = (image_map_t*)malloc( sizeof(image_map_t));
+	map->len = (size_t)stride * height;
+	if( (map->addr = mmap( NULL, map->len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+		thor_errlog( LOG_ERR, "Mapping raw image");
+		free( map);
+		return NULL;
+	}
+	
+	// cairo only reads from a source surface
+	surface = cairo_image_surface_create_for_data( (unsigned char*)map->addr, CAIRO_FORMAT_ARGB32,
+	                                               width, height, stride);
+	if( cairo_surface_set_user_data( surface, &image_map_key, map, unmap_image) != CAIRO_STATUS_SUCCESS ) {
+		cairo_surface_destroy( surface);
+		unmap_image( map);
+		return NULL;
+	}
+	
+	pattern = cairo_pattern_create_for_surface( surface);
+	cairo_surface_destroy( surface);
+	if( cairo_pattern_status( pattern) != CAIRO_STATUS_SUCCESS ) {
+		cairo_pattern_destroy( pattern);
+		return NULL;
+	}
+	
+	cairo_matrix_init_scale( &scaling, width, height);
+	cairo_pattern_set_matrix( pattern, &scaling);
+	
+	return pattern;
+};
+
+
 /*
  * Loads image_cache from file and creates cairo_patterns for every filename.
  * Returns: 0 on success, -1 on read error.
@@ -110,7 +248,12 @@ load_image_cache()
 		return 0;
 	}
 	
-	fread( image_cache, sizeof(image_cache_t), IMAGE_CACHE_SIZE, cache_file);
+	// a file of another size was written by an older version
+	if( fread( image_cache, sizeof(image_cache_t), IMAGE_CACHE_SIZE, cache_file) != IMAGE_CACHE_SIZE ||
+	    fgetc( cache_file) != EOF ) {
+		thor_log( LOG_DEBUG, "Discarding image cache of another version.");
+		memset( image_cache, 0, sizeof(image_cache));
+	}
 	fclose( cache_file);
 	
 	/** create cairo_patterns from files **/
@@ -138,6 +281,7 @@ load_image_cache()
 				cairo_pattern_set_matrix( pattern, &scaling);
 				cairo_surface_destroy( surface);
 				image_cache[i].pattern = pattern;
+				image_stamp( image_cache[i].filename, &image_cache[i].stamp);
 			}
 		}
 	}
@@ -9,7 +9,16 @@
 
 
 #ifdef CAIRO_H
+typedef struct
+{
+	int64_t         mtime_ns;
+	int64_t         size;
+} image_stamp_t;
+
+int             image_stamp( const char *filename, image_stamp_t *stamp);
 cairo_pattern_t *get_pattern_for_png( char *filename);
+cairo_pattern_t *get_pattern_for_memfd( int fd, unsigned int width, unsigned int height,
+                                        unsigned int stride);
 #else
 extern char image_cache_path[];
 #endif
@@ -0,0 +1,845 @@
+/* ************************************************************* *\
+ * libthor.c                                                     *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Client library for sending notifications to      *
+ *              NotificaThor without spawning thor-cli.          *
+\* ************************************************************* */
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "com.h"
+#include "ring.h"
+#include "thor.h"
+
+
+#define MAX_PENDING  64         // frames buffered by thor_send_async()
+
+typedef struct pending_
+{
+	struct pending_ *next;
+	int             fd;         // descriptor to pass with the first byte, -1 if none
+	size_t          len;
+	size_t          off;        // bytes sent so far
+	char            data[];
+} pending_t;
+
+struct thor_client_
+{
+	int                sockfd;
+	struct sockaddr_un saddr;
+	pending_t          *pending;    // frames not completely sent yet, oldest first
+	int                npending;
+};
+
+struct thor_ring_
+{
+	int                sockfd;      // the daemon keeps the ring while this stays open
+	int                efd;
+	ring_shm_t         *shm;
+};
+
+
+/*
+ * Fills in the path of the socket.
+ * 
+ * Parameters: saddr       - Address to fill in.
+ *             socket_path - Path of the socket, NULL for the default.
+ * 
+ * Returns: 0 on success, -1 if the path is too long.
+ */
+static int
+socket_address( struct sockaddr_un *saddr, const char *socket_path)
+{
+	const char *env, *suffix;
+	
+	
+	memset( saddr, 0, sizeof(struct sockaddr_un));
+	saddr->sun_family = AF_UNIX;
+	
+	if( socket_path ) {
+		env    = socket_path;
+		suffix = "";
+	}
+	else if( (env = getenv( "XDG_CACHE_HOME")) && *env )
+		suffix = "/NotificaThor/socket";
+	else {
+		env    = getenv( "HOME");
+		suffix = "/.cache/NotificaThor/socket";
+	}
+	
+	if( !env || strlen( env) + strlen( suffix) >= sizeof(saddr->sun_path) ) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcat( strcpy( saddr->sun_path, env), suffix);
+	
+	return 0;
+};
+
+
+/*
+ * Opens a connection to the daemon.
+ * 
+ * Parameters: saddr - Address of the socket.
+ * 
+ * Returns: Filedescriptor of the socket, -1 on error and sets errno.
+ */
+static int
+open_socket( struct sockaddr_un *saddr)
+{
+	int sockfd, err;
+	
+	
+	if( (sockfd = socket( AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1 )
+		return -1;
+	
+	if( connect( sockfd, (struct sockaddr*)saddr, sizeof(struct sockaddr_un)) == -1 ) {
+		err = errno;
+		close( sockfd);
+		errno = err;
+		return -1;
+	}
+	
+	return sockfd;
+};
+
+
+/*
+ * Replaces a broken connection. A frame that was only partly sent
+ * is sent again from the start.
+ * 
+ * Parameters: client - The client.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+static int
+reconnect( thor_client_t *client)
+{
+	if( client->sockfd != -1 )
+		close( client->sockfd);
+	
+	client->sockfd = open_socket( &client->saddr);
+	if( client->pending )
+		client->pending->off = 0;
+	
+	return ( client->sockfd == -1 ) ? -1 : 0;
+};
+
+
+/*
+ * Errors on which the daemon has gone away.
+ */
+static int
+is_broken( int err)
+{
+	return err == EPIPE || err == ECONNRESET || err == ENOTCONN || err == EBADF;
+};
+
+
+/*
+ * Sends data, optionally together with a filedescriptor.
+ * 
+ * Parameters: sockfd - The socket.
+ *             iov    - Data to send.
+ *             iovcnt - Number of elements in iov.
+ *             fd     - Descriptor to pass, -1 for none.
+ *             flags  - Flags for sendmsg().
+ * 
+ * Returns: Number of bytes sent, -1 on error and sets errno.
+ */
+static ssize_t
+send_fd( int sockfd, struct iovec *iov, int iovcnt, int fd, int flags)
+{
+	struct msghdr mhdr = {0};
+	union
+	{
+		char           buf[CMSG_SPACE( sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	
+	
+	mhdr.msg_iov    = iov;
+	mhdr.msg_iovlen = iovcnt;
+	
+	if( fd != -1 ) {
+		struct cmsghdr *cmsg;
+		
+		
+		mhdr.msg_control    = control.buf;
+		mhdr.msg_controllen = sizeof(control.buf);
+		cmsg                = CMSG_FIRSTHDR( &mhdr);
+		cmsg->cmsg_level    = SOL_SOCKET;
+		cmsg->cmsg_type     = SCM_RIGHTS;
+		cmsg->cmsg_len      = CMSG_LEN( sizeof(int));
+		memcpy( CMSG_DATA( cmsg), &fd, sizeof(int));
+	}
+	
+	return sendmsg( sockfd, &mhdr, flags|MSG_NOSIGNAL);
+};
+
+
+/*
+ * Sends buffered frames.
+ * 
+ * Parameters: client - The client.
+ *             flags  - MSG_DONTWAIT to return instead of blocking.
+ * 
+ * Returns: 0 if everything has been sent, 1 if frames are left and
+ *          -1 on error and sets errno.
+ */
+static int
+send_pending( thor_client_t *client, int flags)
+{
+	int reconnected = 0;
+	
+	
+	while( client->pending ) {
+		pending_t    *p  = client->pending;
+		struct iovec iov = { p->data + p->off, p->len - p->off };
+		ssize_t      ret;
+		
+		
+		if( client->sockfd == -1 && reconnect( client) == -1 )
+			return -1;
+		
+		ret = send_fd( client->sockfd, &iov, 1, ( p->off == 0 ) ? p->fd : -1, flags);
+		if( ret == -1 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				return 1;
+			if( !is_broken( errno) || reconnected++ || reconnect( client) == -1 )
+				return -1;
+			continue;
+		}
+		
+		p->off += ret;
+		if( p->off == p->len ) {
+			client->pending = p->next;
+			client->npending--;
+			if( p->fd != -1 )
+				close( p->fd);
+			free( p);
+		}
+	}
+	
+	return 0;
+};
+
+
+/*
+ * Buffers the unsent rest of a frame.
+ * 
+ * Parameters: client - The client.
+ *             iov    - The whole frame.
+ *             iovcnt - Number of elements in iov.
+ *             fd     - Descriptor passed with the frame, -1 for none.
+ *             sent   - Bytes of the frame that have been sent already.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+static int
+queue_frame( thor_client_t *client, struct iovec *iov, int iovcnt, int fd, size_t sent)
+{
+	pending_t *p, **pos;
+	size_t    len = 0;
+	int       i;
+	
+	
+	if( client->npending == MAX_PENDING ) {
+		errno = EAGAIN;
+		return -1;
+	}
+	
+	for( i = 0; i < iovcnt; i++ )
+		len += iov[i].iov_len;
+	
+	if( (p = (pending_t*)malloc( sizeof(pending_t) + len)) == NULL )
+		return -1;
+	
+	// keep the descriptor, the frame is sent again after a reconnect
+	if( fd != -1 && (fd = fcntl( fd, F_DUPFD_CLOEXEC, 0)) == -1 ) {
+		free( p);
+		return -1;
+	}
+	
+	p->next = NULL;
+	p->fd   = fd;
+	p->len  = 0;
+	p->off  = sent;
+	for( i = 0; i < iovcnt; i++ ) {
+		memcpy( p->data + p->len, iov[i].iov_base, iov[i].iov_len);
+		p->len += iov[i].iov_len;
+	}
+	
+	for( pos = &client->pending; *pos; pos = &(*pos)->next );
+	*pos = p;
+	client->npending++;
+	
+	return 0;
+};
+
+
+/*
+ * Builds header and payload of a notification.
+ * 
+ * Parameters: n   - The notification.
+ *             hdr - Header to fill in.
+ *             iov - Three iovecs for header, images and message.
+ * 
+ * Returns: 0 on success, -1 if the payload is too large.
+ */
+static int
+pack_notification( const thor_notification_t *n, thor_header *hdr, struct iovec *iov)
+{
+	static const char no_images[1] = "";
+	const char        *img;
+	
+	
+	memset( hdr, 0, sizeof(thor_header));
+	hdr->magic        = COM_MAGIC;
+	hdr->version      = COM_VERSION;
+	hdr->header_len   = sizeof(thor_header);
+	hdr->flags        = (n->flags & (THOR_NO_IMAGE|THOR_NO_BAR|THOR_WAIT)) | COM_SESSION;
+	hdr->timeout      = ( n->timeout > 0 ) ? n->timeout * 1000 + 0.5 : 0;
+	hdr->bar_part     = n->bar_part;
+	hdr->bar_elements = n->bar_elements;
+	hdr->id           = n->id;
+	
+	/** images end with an empty filename **/
+	iov[1].iov_base = (void*)no_images;
+	iov[1].iov_len  = 1;
+	if( n->images ) {
+		for( img = n->images; *img; img += strlen( img) + 1 );
+		iov[1].iov_base = (void*)n->images;
+		iov[1].iov_len  = img - n->images + 1;
+	}
+	
+	iov[2].iov_base = (void*)n->message;
+	iov[2].iov_len  = ( n->message ) ? strlen( n->message) + 1 : 0;
+	
+	if( iov[1].iov_len + iov[2].iov_len > COM_MAX_PAYLOAD ) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	hdr->image_len   = iov[1].iov_len;
+	hdr->message_len = iov[2].iov_len;
+	
+	if( n->image_fd != -1 ) {
+		hdr->flags        |= COM_IMAGE_FD;
+		hdr->image_width   = n->image_width;
+		hdr->image_height  = n->image_height;
+		hdr->image_stride  = ( n->image_stride ) ? n->image_stride : n->image_width * 4;
+	}
+	
+	iov[0].iov_base = hdr;
+	iov[0].iov_len  = sizeof(thor_header);
+	
+	return 0;
+};
+
+
+/*
+ * Sends a notification.
+ * 
+ * Parameters: client - The client.
+ *             n      - The notification.
+ *             flags  - MSG_DONTWAIT to buffer instead of blocking.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+static int
+send_notification( thor_client_t *client, const thor_notification_t *n, int flags)
+{
+	thor_header  hdr;
+	struct iovec iov[3];
+	ssize_t      ret;
+	size_t       len;
+	int          reconnected = 0;
+	
+	
+	if( pack_notification( n, &hdr, iov) == -1 )
+		return -1;
+	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+	
+	/** keep the order of messages **/
+	if( client->pending ) {
+		if( (ret = send_pending( client, flags)) == -1 )
+			return -1;
+		if( ret == 1 )
+			return queue_frame( client, iov, 3, n->image_fd, 0);
+	}
+	
+	while( 1 ) {
+		if( client->sockfd == -1 && reconnect( client) == -1 )
+			return -1;
+		
+		if( (ret = send_fd( client->sockfd, iov, 3, n->image_fd, flags)) != -1 )
+			break;
+		
+		if( errno == EINTR )
+			continue;
+		if( errno == EAGAIN || errno == EWOULDBLOCK )
+			return queue_frame( client, iov, 3, n->image_fd, 0);
+		if( !is_broken( errno) || reconnected++ || reconnect( client) == -1 )
+			return -1;
+	}
+	
+	if( (size_t)ret < len ) {
+		if( queue_frame( client, iov, 3, n->image_fd, ret) == -1 )
+			return -1;
+		if( !(flags & MSG_DONTWAIT) )
+			return send_pending( client, 0);
+	}
+	
+	return 0;
+};
+
+
+/*
+ * Connects to NotificaThor.
+ * 
+ * Parameters: socket_path - Path of the socket, NULL for the default.
+ * 
+ * Returns: The new client, NULL on error and sets errno.
+ */
+thor_client_t *
+thor_connect( const char *socket_path)
+{
+	thor_client_t *client = (thor_client_t*)malloc( sizeof(thor_client_t));
+	
+	
+	if( client == NULL )
+		return NULL;
+	
+	memset( client, 0, sizeof(thor_client_t));
+	if( socket_address( &client->saddr, socket_path) == -1 ||
+	    (client->sockfd = open_socket( &client->saddr)) == -1 ) {
+		free( client);
+		return NULL;
+	}
+	
+	return client;
+};
+
+
+/*
+ * Returns the socket of a client, poll it for POLLOUT while
+ * thor_flush() returns 1.
+ */
+int
+thor_fd( thor_client_t *client)
+{
+	return client->sockfd;
+};
+
+
+/*
+ * Sends what is left, hangs up and frees a client.
+ * 
+ * Parameters: client - The client.
+ */
+void
+thor_close( thor_client_t *client)
+{
+	send_pending( client, 0);
+	
+	while( client->pending ) {
+		pending_t *p = client->pending;
+		
+		
+		client->pending = p->next;
+		if( p->fd != -1 )
+			close( p->fd);
+		free( p);
+	}
+	
+	if( client->sockfd != -1 )
+		close( client->sockfd);
+	free( client);
+};
+
+
+/*
+ * Sends a notification, blocks until it has been written to the socket.
+ * 
+ * Parameters: client       - The client.
+ *             notification - The notification.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+int
+thor_send( thor_client_t *client, const thor_notification_t *notification)
+{
+	return send_notification( client, notification, 0);
+};
+
+
+/*
+ * Sends a notification without blocking. What cannot be written at once
+ * is buffered and sent by later calls or thor_flush().
+ * 
+ * Parameters: client       - The client.
+ *             notification - The notification.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno to EAGAIN
+ *          if too many messages are buffered.
+ */
+int
+thor_send_async( thor_client_t *client, const thor_notification_t *notification)
+{
+	return send_notification( client, notification, MSG_DONTWAIT);
+};
+
+
+/*
+ * Sends buffered notifications without blocking.
+ * 
+ * Parameters: client - The client.
+ * 
+ * Returns: 0 if everything has been sent, 1 if notifications are left
+ *          and -1 on error and sets errno.
+ */
+int
+thor_flush( thor_client_t *client)
+{
+	return send_pending( client, MSG_DONTWAIT);
+};
+
+
+/*
+ * Waits for the reply to the oldest message sent with THOR_WAIT,
+ * that has not been waited for yet.
+ * 
+ * Parameters: client - The client.
+ *             timing - Pointer to where status and timestamps are stored.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+int
+thor_wait( thor_client_t *client, thor_timing_t *timing)
+{
+	thor_reply reply;
+	size_t     fill = 0;
+	ssize_t    ret;
+	
+	
+	if( send_pending( client, 0) == -1 )
+		return -1;
+	
+	while( fill < sizeof(thor_reply) ) {
+		if( (ret = read( client->sockfd, (char*)&reply + fill, sizeof(thor_reply) - fill)) == -1 ) {
+			if( errno == EINTR )
+				continue;
+			return -1;
+		}
+		else if( ret == 0 ) {
+			errno = ECONNABORTED;
+			return -1;
+		}
+		fill += ret;
+	}
+	
+	if( reply.magic != COM_MAGIC ) {
+		errno = EBADMSG;
+		return -1;
+	}
+	
+	timing->status    = reply.status;
+	timing->received  = reply.received;
+	timing->layout    = reply.layout;
+	timing->raster    = reply.raster;
+	timing->presented = reply.presented;
+	
+	return 0;
+};
+
+
+/*
+ * Receives the MSG_ACK answering COM_RING together with memfd and eventfd.
+ * 
+ * Parameters: sockfd - The socket.
+ *             fds    - Array for memfd and eventfd.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+static int
+recv_ring( int sockfd, int *fds)
+{
+	char           ack;
+	struct iovec   iov  = { &ack, 1 };
+	struct msghdr  mhdr = {0};
+	struct cmsghdr *cmsg;
+	ssize_t        ret;
+	union
+	{
+		char           buf[CMSG_SPACE( 2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	
+	
+	mhdr.msg_iov        = &iov;
+	mhdr.msg_iovlen     = 1;
+	mhdr.msg_control    = control.buf;
+	mhdr.msg_controllen = sizeof(control.buf);
+	
+	while( (ret = recvmsg( sockfd, &mhdr, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR );
+	if( ret == -1 )
+		return -1;
+	
+	cmsg = CMSG_FIRSTHDR( &mhdr);
+	if( ret != 1 || ack != MSG_ACK || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN( 2 * sizeof(int)) ) {
+		if( cmsg && cmsg->cmsg_type == SCM_RIGHTS ) {
+			int i, n = ( cmsg->cmsg_len - CMSG_LEN( 0) ) / sizeof(int);
+			
+			
+			for( i = 0; i < n; i++ )
+				close( ((int*)CMSG_DATA( cmsg))[i]);
+		}
+		errno = ( ret == 0 ) ? ECONNABORTED : EPROTO;
+		return -1;
+	}
+	
+	memcpy( fds, CMSG_DATA( cmsg), 2 * sizeof(int));
+	
+	return 0;
+};
+
+
+/*
+ * Asks the daemon for a shared memory ring over a connection of its own.
+ * 
+ * Parameters: socket_path - Path of the socket, NULL for the default.
+ * 
+ * Returns: The mapped ring, NULL on error and sets errno.
+ */
+thor_ring_t *
+thor_ring_open( const char *socket_path)
+{
+	thor_header        hdr  = { COM_MAGIC, COM_VERSION, sizeof(thor_header), COM_RING };
+	struct sockaddr_un saddr;
+	thor_ring_t        *ring;
+	int                fds[2];
+	int                err;
+	
+	
+	if( (ring = (thor_ring_t*)malloc( sizeof(thor_ring_t))) == NULL )
+		return NULL;
+	
+	if( socket_address( &saddr, socket_path) == -1 ||
+	    (ring->sockfd = open_socket( &saddr)) == -1 ) {
+		free( ring);
+		return NULL;
+	}
+	
+	if( send( ring->sockfd, &hdr, sizeof(thor_header), MSG_NOSIGNAL) != sizeof(thor_header) ||
+	    recv_ring( ring->sockfd, fds) == -1 )
+		goto err;
+	
+	ring->efd = fds[1];
+	ring->shm = (ring_shm_t*)mmap( NULL, sizeof(ring_shm_t), PROT_READ|PROT_WRITE, MAP_SHARED,
+	                               fds[0], 0);
+	close( fds[0]);
+	if( ring->shm == MAP_FAILED ) {
+		close( ring->efd);
+		goto err;
+	}
+	
+	if( ring->shm->magic != RING_MAGIC || ring->shm->nentries != RING_ENTRIES ) {
+		munmap( ring->shm, sizeof(ring_shm_t));
+		close( ring->efd);
+		errno = EPROTO;
+		goto err;
+	}
+	
+	return ring;
+	
+  err:
+	err = errno;
+	close( ring->sockfd);
+	free( ring);
+	errno = err;
+	return NULL;
+};
+
+
+/*
+ * Publishes a bar update to a ring. Never blocks, the daemon is woken
+ * only if it is waiting for the ring.
+ * 
+ * Parameters: ring         - The ring.
+ *             notification - The update, images, message, image_fd and
+ *                            THOR_WAIT cannot be published.
+ * 
+ * Returns: 0 on success, -1 and sets errno to EINVAL if the notification
+ *          does not fit into the ring.
+ */
+int
+thor_ring_publish( thor_ring_t *ring, const thor_notification_t *notification)
+{
+	const thor_notification_t *n  = notification;
+	ring_shm_t                *shm = ring->shm;
+	unsigned int              head, seq;
+	ring_entry_t              *e;
+	
+	
+	if( (n->images && *n->images) || (n->message && *n->message) ||
+	    n->image_fd != -1 || (n->flags & THOR_WAIT) ) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	head = atomic_load_explicit( &shm->head, memory_order_relaxed);
+	e    = &shm->entry[head % RING_ENTRIES];
+	seq  = atomic_load_explicit( &e->seq, memory_order_relaxed);
+	
+	/** odd seq marks the entry as being written **/
+	atomic_store_explicit( &e->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence( memory_order_release);
+	
+	e->flags        = n->flags & (THOR_NO_IMAGE|THOR_NO_BAR);
+	e->timeout      = ( n->timeout > 0 ) ? n->timeout * 1000 + 0.5 : 0;
+	e->bar_elements = n->bar_elements;
+	e->bar_part     = n->bar_part;
+	e->id           = n->id;
+	
+	atomic_store_explicit( &e->seq, seq + 2, memory_order_release);
+	atomic_store( &shm->head, head + 1);
+	
+	/** wake the daemon only if it is waiting **/
+	if( atomic_exchange( &shm->armed, 0) ) {
+		uint64_t one = 1;
+		
+		
+		write( ring->efd, &one, sizeof(uint64_t));
+	}
+	
+	return 0;
+};
+
+
+/*
+ * Unmaps a ring and hangs up, the daemon frees it then.
+ * 
+ * Parameters: ring - The ring.
+ */
+void
+thor_ring_close( thor_ring_t *ring)
+{
+	munmap( ring->shm, sizeof(ring_shm_t));
+	close( ring->efd);
+	close( ring->sockfd);
+	free( ring);
+};
+
+
+/*
+ * Creates a memfd for a raw image and maps it, so the image can be
+ * drawn in place as premultiplied ARGB32 with a stride of 4 * width.
+ * 
+ * Parameters: width, height - Dimensions of the image.
+ *             pixels        - Pointer to where the mapping is stored.
+ * 
+ * Returns: The memfd, -1 on error and sets errno.
+ */
+int
+thor_image_create( unsigned int width, unsigned int height, void **pixels)
+{
+	size_t size = (size_t)width * 4 * height;
+	int    fd, err;
+	
+	
+	if( (fd = memfd_create( "thor-image", MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1 )
+		return -1;
+	
+	if( ftruncate( fd, size) == -1 ||
+	    (*pixels = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+		err = errno;
+		close( fd);
+		errno = err;
+		return -1;
+	}
+	
+	return fd;
+};
+
+
+/*
+ * Unmaps a raw image and seals it, so it can be sent.
+ * 
+ * Parameters: fd     - The memfd from thor_image_create().
+ *             pixels - The mapping from thor_image_create().
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+int
+thor_image_seal( int fd, void *pixels)
+{
+	struct stat st;
+	
+	
+	if( fstat( fd, &st) == -1 )
+		return -1;
+	
+	munmap( pixels, st.st_size);
+	
+	return fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+};
+
+
+/*
+ * Queries the counters of NotificaThor.
+ * 
+ * Parameters: socket_path - Path of the socket, NULL for the default.
+ *             buffer      - Buffer for the "name value" lines.
+ *             size        - Size of buffer.
+ * 
+ * Returns: Length of the reply without the terminating '\0',
+ *          -1 on error and sets errno.
+ */
+int
+thor_stats( const char *socket_path, char *buffer, size_t size)
+{
+	thor_header        hdr  = { COM_MAGIC, COM_VERSION, sizeof(thor_header), COM_STATS|COM_NO_ACK };
+	struct sockaddr_un saddr;
+	size_t             fill = 0;
+	ssize_t            ret;
+	int                sockfd;
+	
+	
+	if( size == 0 || socket_address( &saddr, socket_path) == -1 ||
+	    (sockfd = open_socket( &saddr)) == -1 )
+		return -1;
+	
+	if( write( sockfd, &hdr, sizeof(thor_header)) != sizeof(thor_header) ) {
+		close( sockfd);
+		return -1;
+	}
+	
+	/** the daemon hangs up after the reply **/
+	while( fill < size - 1 && (ret = read( sockfd, buffer + fill, size - 1 - fill)) > 0 )
+		fill += ret;
+	buffer[fill] = '\0';
+	close( sockfd);
+	
+	return fill;
+};
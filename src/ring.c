@@ -0,0 +1,207 @@
+/* ************************************************************* *\
+ * ring.c                                                        *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Daemon side of the shared memory ring buffer     *
+ *              for bar updates.                                 *
+\* ************************************************************* */
+
+
+#define _GNU_SOURCE
+#define RING_DAEMON
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "com.h"
+#include "ring.h"
+#include "logging.h"
+
+
+#define RING_MAX_RETRIES  64
+
+
+/*
+ * Creates a ring in a sealed memfd and an eventfd for wakeups.
+ * 
+ * Parameters: conn - The connection that requested the ring.
+ * 
+ * Returns: Handle of the new ring, NULL on error.
+ */
+ring_handle_t *
+ring_create( void *conn)
+{
+	ring_handle_t *handle = (ring_handle_t*)malloc( sizeof(ring_handle_t));
+	
+	
+	memset( handle, 0, sizeof(ring_handle_t));
+	handle->kind = EV_RING;
+	handle->conn = conn;
+	handle->efd  = -1;
+	
+	if( (handle->memfd = memfd_create( "NotificaThor-ring", MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1 ) {
+		thor_errlog( LOG_ERR, "Creating ring memfd");
+		goto err;
+	}
+	
+	if( ftruncate( handle->memfd, sizeof(ring_shm_t)) == -1 ||
+	    fcntl( handle->memfd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) == -1 ) {
+		thor_errlog( LOG_ERR, "Sizing ring memfd");
+		goto err;
+	}
+	
+	handle->ring = (ring_shm_t*)mmap( NULL, sizeof(ring_shm_t), PROT_READ|PROT_WRITE, MAP_SHARED,
+	                                  handle->memfd, 0);
+	if( handle->ring == MAP_FAILED ) {
+		handle->ring = NULL;
+		thor_errlog( LOG_ERR, "Mapping ring");
+		goto err;
+	}
+	
+	if( (handle->efd = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1 ) {
+		thor_errlog( LOG_ERR, "Creating ring eventfd");
+		goto err;
+	}
+	
+	handle->ring->magic    = RING_MAGIC;
+	handle->ring->nentries = RING_ENTRIES;
+	atomic_store( &handle->ring->armed, 1);
+	
+	return handle;
+	
+  err:
+	ring_free( handle);
+	return NULL;
+};
+
+
+/*
+ * Hands memfd and eventfd of a ring over to the client. The memfd is
+ * closed afterwards, the mapping keeps the ring alive.
+ * 
+ * Parameters: handle - The ring.
+ *             sockfd - Socket of the client.
+ * 
+ * Returns: 0 on success, -1 on error and sets errno.
+ */
+int
+ring_send( ring_handle_t *handle, int sockfd)
+{
+	char           ack = MSG_ACK;
+	struct iovec   iov = { &ack, 1 };
+	struct msghdr  mhdr = {0};
+	struct cmsghdr *cmsg;
+	union
+	{
+		char           buf[CMSG_SPACE( 2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	
+	
+	mhdr.msg_iov        = &iov;
+	mhdr.msg_iovlen     = 1;
+	mhdr.msg_control    = control.buf;
+	mhdr.msg_controllen = sizeof(control.buf);
+	
+	cmsg             = CMSG_FIRSTHDR( &mhdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN( 2 * sizeof(int));
+	((int*)CMSG_DATA( cmsg))[0] = handle->memfd;
+	((int*)CMSG_DATA( cmsg))[1] = handle->efd;
+	
+	if( sendmsg( sockfd, &mhdr, MSG_NOSIGNAL) != 1 )
+		return -1;
+	
+	close( handle->memfd);
+	handle->memfd = -1;
+	
+	return 0;
+};
+
+
+/*
+ * Fetches the latest entry of a ring and arms it again, so the client
+ * signals the next update.
+ * 
+ * Parameters: handle - The ring.
+ *             entry  - Pointer to where the latest entry is copied to.
+ * 
+ * Returns: Number of updates published since the last call,
+ *          0 if there is nothing new.
+ */
+int
+ring_consume( ring_handle_t *handle, ring_entry_t *entry)
+{
+	ring_shm_t   *ring = handle->ring;
+	unsigned int head, seq, retries;
+	uint64_t     counter;
+	int          ret;
+	
+	
+	read( handle->efd, &counter, sizeof(uint64_t));
+	atomic_store( &ring->armed, 1);
+	
+	for( retries = 0; retries < RING_MAX_RETRIES; retries++ ) {
+		ring_entry_t *e;
+		
+		
+		head = atomic_load( &ring->head);
+		if( head == handle->tail )
+			return 0;
+		
+		e   = &ring->entry[(head - 1) % RING_ENTRIES];
+		seq = atomic_load_explicit( &e->seq, memory_order_acquire);
+		if( seq & 1 )
+			continue;
+		
+		entry->flags        = e->flags;
+		entry->timeout      = e->timeout;
+		entry->bar_elements = e->bar_elements;
+		entry->bar_part     = e->bar_part;
+		entry->id           = e->id;
+		
+		atomic_thread_fence( memory_order_acquire);
+		if( atomic_load_explicit( &e->seq, memory_order_relaxed) == seq )
+			break;
+	}
+	
+	/** the producer keeps overwriting the entry, try again on the next wakeup **/
+	if( retries == RING_MAX_RETRIES )
+		return 0;
+	
+	ret          = head - handle->tail;
+	handle->tail = head;
+	
+	return ret;
+};
+
+
+/*
+ * Unmaps a ring and closes its filedescriptors.
+ * 
+ * Parameters: handle - The ring.
+ */
+void
+ring_free( ring_handle_t *handle)
+{
+	if( handle->ring )
+		munmap( handle->ring, sizeof(ring_shm_t));
+	if( handle->memfd != -1 )
+		close( handle->memfd);
+	if( handle->efd != -1 )
+		close( handle->efd);
+	
+	free( handle);
+};
@@ -0,0 +1,62 @@
+/* ************************************************************* *\
+ * ring.h                                                        *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Shared memory ring buffer for bar updates,       *
+ *              used by daemon and clients.                      *
+\* ************************************************************* */
+
+
+/*
+ * A client sends a frame with COM_RING set and receives a single MSG_ACK
+ * byte carrying two file descriptors (SCM_RIGHTS): a sealed memfd holding
+ * a ring_shm_t, which it maps shared and writable, and an eventfd.
+ * The ring lives as long as that connection stays open.
+ * 
+ * Clients publish updates with thor_ring_publish() of libthor. The eventfd
+ * is only written when the daemon is idle, so a burst of updates costs at
+ * most one syscall. The daemon only ever renders the latest entry.
+ */
+#define RING_MAGIC    0x474e4952      // "RING"
+#define RING_ENTRIES  64
+
+typedef struct
+{
+	atomic_uint  seq;           // odd while the entry is being written
+	uint32_t     flags;         // COM_NO_IMAGE, COM_NO_BAR
+	uint32_t     timeout;       // milliseconds, 0 for default
+	uint32_t     bar_elements;
+	uint32_t     bar_part;
+	uint32_t     id;
+} ring_entry_t;
+
+typedef struct
+{
+	uint32_t     magic;
+	uint32_t     nentries;
+	atomic_uint  head;          // number of entries published so far
+	atomic_uint  armed;         // set by the daemon before it goes to sleep
+	ring_entry_t entry[RING_ENTRIES];
+} ring_shm_t;
+
+
+#ifdef RING_DAEMON
+
+typedef struct ring_handle_
+{
+	int          kind;          // EV_RING, must be first
+	int          memfd;
+	int          efd;
+	ring_shm_t   *ring;
+	unsigned int tail;          // entries consumed so far
+	void         *conn;         // connection owning the ring
+} ring_handle_t;
+
+ring_handle_t *ring_create( void *conn);
+int           ring_send( ring_handle_t *handle, int sockfd);
+int           ring_consume( ring_handle_t *handle, ring_entry_t *entry);
+void          ring_free( ring_handle_t *handle);
+
+#endif /* RING_DAEMON */
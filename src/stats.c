@@ -0,0 +1,64 @@
+/* ************************************************************* *\
+ * stats.c                                                       *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Counters of the daemon, that can be queried      *
+ *              with 'thor-cli --stats'.                         *
+\* ************************************************************* */
+
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+
+thor_stats_t stats = {0};
+
+
+/*
+ * Prints all counters as "name value" lines.
+ * 
+ * Parameters: buffer - Buffer to print to.
+ *             size   - Size of buffer.
+ * 
+ * Returns: Number of characters written, without the terminating '\0'.
+ */
+int
+format_stats( char *buffer, size_t size)
+{
+	return snprintf( buffer, size,
+	                 "messages_received %"PRIu64"\n"
+	                 "messages_rendered %"PRIu64"\n"
+	                 "updates_coalesced %"PRIu64"\n"
+	                 "ring_updates %"PRIu64"\n"
+	                 "surface_reallocs %"PRIu64"\n"
+	                 "partial_redraws %"PRIu64"\n"
+	                 "base_renders %"PRIu64"\n"
+	                 "uploads %"PRIu64"\n"
+	                 "shm_uploads %"PRIu64"\n"
+	                 "upload_ns %"PRIu64"\n"
+	                 "shape_updates %"PRIu64"\n"
+	                 "text_cache_hits %"PRIu64"\n"
+	                 "text_cache_misses %"PRIu64"\n"
+	                 "font_cache_hits %"PRIu64"\n"
+	                 "font_cache_misses %"PRIu64"\n",
+	                 stats.messages_received,
+	                 stats.messages_rendered,
+	                 stats.updates_coalesced,
+	                 stats.ring_updates,
+	                 stats.surface_reallocs,
+	                 stats.partial_redraws,
+	                 stats.base_renders,
+	                 stats.uploads,
+	                 stats.shm_uploads,
+	                 stats.upload_ns,
+	                 stats.shape_updates,
+	                 stats.text_cache_hits,
+	                 stats.text_cache_misses,
+	                 stats.font_cache_hits,
+	                 stats.font_cache_misses);
+};
@@ -0,0 +1,43 @@
+/* ************************************************************* *\
+ * stats.h                                                       *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Counters of the daemon, that can be queried      *
+ *              with 'thor-cli --stats'.                         *
+\* ************************************************************* */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef struct
+{
+	uint64_t messages_received;
+	uint64_t messages_rendered;
+	uint64_t updates_coalesced;     // updates dropped because a newer one had the same id
+	uint64_t ring_updates;          // updates published through shared memory rings
+	uint64_t surface_reallocs;      // window and buffering surface had to be recreated
+	uint64_t partial_redraws;       // popups where only the changed bar or text was drawn
+	uint64_t base_renders;          // background and image had to be drawn again
+	uint64_t uploads;               // copies of the buffering surface to the window
+	uint64_t shm_uploads;           // uploads through MIT-SHM
+	uint64_t upload_ns;             // time spent in uploads
+	uint64_t shape_updates;         // input regions sent to the X server
+	uint64_t text_cache_hits;       // messages drawn with a cached layout
+	uint64_t text_cache_misses;     // messages that had to be laid out
+	uint64_t font_cache_hits;       // fonts shared with another theme or reload
+	uint64_t font_cache_misses;     // fonts that had to be created
+} thor_stats_t;
+
+extern thor_stats_t stats;
+
+
+int format_stats( char *buffer, size_t size);
+
+#endif /* STATS_H */
@@ -10,9 +10,13 @@
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-ft.h>
+#include <errno.h>
 #include <fontconfig/fontconfig.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
 
 #define CONFIG_GRAPHICAL
 #define TEXT_PRIVATE
@@ -23,113 +27,305 @@
 #include "config.h"
 #include "drawing.h"
 #include "NotificaThor.h"
+#include "logging.h"
+#include "stats.h"
+
+
+#define TEXT_CACHE_SIZE  16
+#define FONT_CACHE_SIZE  8
+
+#define STYLE_REGULAR      0
+#define STYLE_BOLD         (1 << 0)
+#define STYLE_ITALIC       (1 << 1)
+#define STYLE_BOLD_ITALIC  (STYLE_BOLD|STYLE_ITALIC)
+#define STYLE( var)        (var & STYLE_BOLD_ITALIC)
+#define STYLE_UNDERLINED   (1 << 2)
+#define STYLE_NEWWORD      (1 << 3)
+#define STYLE_NEWLINE      (1 << 4)
+#define STYLE_END          (1 << 5)
+
+typedef struct
+{
+	char        *message;       // NULL for an unused entry
+	size_t      len;
+	thor_font_t *font;
+	double      fwidth;
+	text_box_t  *box;
+	uint64_t    last_used;
+} text_cache_t;
+
+static text_cache_t text_cache[TEXT_CACHE_SIZE] = {{0}};
+static uint64_t     text_cache_clock = 0;
+static thor_font_t  *font_cache[FONT_CACHE_SIZE] = {0};
+
+/*
+ * Arena prepare_text() lays out into. It is reserved once per message for
+ * the most elements the message can need and kept for the next one, the
+ * finished layout is then copied into a single block.
+ */
+typedef struct
+{
+	text_line     *line;
+	text_word     *word;
+	text_fragment *frag;
+	int           size;         // lines, words and fragments each
+	
+	cairo_glyph_t *glyphs;
+	int           nglyphs;
+	int           size_glyphs;
+	double        *advance;     // prefix sums for the fragment being added, size_glyphs + 1
+} text_arena_t;
+
+static text_arena_t arena = {0};
+
+
+/*
+ * Creates a scaled font for a substituted pattern.
+ * 
+ * Parameters: pattern - The fontconfig pattern.
+ *             matrix  - Font matrix, scales to the pixel size.
+ * 
+ * Returns: The scaled font.
+ */
+static cairo_scaled_font_t *
+create_face( FcPattern *pattern, cairo_matrix_t *matrix)
+{
+	cairo_font_face_t    *face = cairo_ft_font_face_create_for_pattern( pattern);
+	cairo_font_options_t *fopts = cairo_font_options_create();
+	cairo_scaled_font_t  *res;
+	cairo_matrix_t       user_matrix;
+	
+	
+	cairo_matrix_init_identity( &user_matrix);
+	res = cairo_scaled_font_create( face, matrix, &user_matrix, fopts);
+	
+	cairo_font_face_destroy( face);
+	cairo_font_options_destroy( fopts);
+	
+	return res;
+};
+
+
+/*
+ * Frees a thor_font_t with all of its styles.
+ * 
+ * Parameters: font - thor_font_t to destroy.
+ */
+static void
+destroy_font( thor_font_t *font)
+{
+	int i;
+	
+	
+	for( i = 0; i < NSTYLES; i++ )
+		if( font->face[i] )
+			cairo_scaled_font_destroy( font->face[i]);
+	
+	FcPatternDestroy( font->pattern);
+	free( font->name);
+	free( font);
+};
+
+
+/*
+ * Puts a new font into the font cache, replacing one that is not used anymore.
+ * If every entry is used, the font stays out of the cache and is destroyed
+ * with its last reference.
+ * 
+ * Parameters: font - The new thor_font_t.
+ */
+static void
+cache_font( thor_font_t *font)
+{
+	int i;
+	
+	
+	for( i = 0; i < FONT_CACHE_SIZE; i++ ) {
+		if( font_cache[i] == NULL || font_cache[i]->refs == 0 ) {
+			if( font_cache[i] )
+				destroy_font( font_cache[i]);
+			font_cache[i] = font;
+			return;
+		}
+	}
+};
 
 
 /*
- * Creates a thor_font_t object by combining config_default_font and
- * font_name to a pattern.
+ * Gets a thor_font_t for the pattern combined from config_default_font and
+ * font_name. Fonts are shared by their resolved pattern, only the regular
+ * style is created here.
  * 
  * Parameters: font_name - String describing the font used.
  * 
- * Returns: thor_font_t structure.
+ * Returns: thor_font_t structure, release it with free_font().
  */
 thor_font_t *
 init_font( char *font_name)
 {
-	double               size, pixel_size;
-	cairo_font_face_t    *face;
-	cairo_matrix_t       font_matrix, user_matrix;
-	cairo_font_options_t *fopts = cairo_font_options_create();
-	
-	thor_font_t *res = (thor_font_t*)malloc( sizeof(thor_font_t));
+	double      pixel_size = 0;
+	FcChar8     *name;
+	thor_font_t *res;
+	int         i;
 	
 	FcPattern *fc_default = FcNameParse( (FcChar8*)config_default_font);
 	FcPattern *fc_theme   = FcNameParse( (FcChar8*)font_name);
-	FcPattern *fc_regular = FcFontRenderPrepare( NULL, fc_default, fc_theme);
-	FcPattern *fc_bold    = FcPatternDuplicate( fc_regular);
-	FcPattern *fc_italic  = FcPatternDuplicate( fc_regular);
-	FcPattern *fc_bitalic = FcPatternDuplicate( fc_regular);
+	FcPattern *fc_base    = FcFontRenderPrepare( NULL, fc_default, fc_theme);
+	FcPattern *fc_regular = FcPatternDuplicate( fc_base);
 	
 	
 	FcPatternDestroy( fc_default);
 	FcPatternDestroy( fc_theme);
 	
-	FcPatternAddInteger( fc_bold   , FC_WEIGHT, FC_WEIGHT_BOLD);
-	FcPatternAddInteger( fc_italic , FC_SLANT , FC_SLANT_ITALIC);
-	FcPatternAddInteger( fc_bitalic, FC_WEIGHT, FC_WEIGHT_BOLD);
-	FcPatternAddInteger( fc_bitalic, FC_SLANT , FC_SLANT_ITALIC);
-	
 	FcConfigSubstitute( NULL, fc_regular, FcMatchFont);
-	FcConfigSubstitute( NULL, fc_bold   , FcMatchFont);
-	FcConfigSubstitute( NULL, fc_italic , FcMatchFont);
-	FcConfigSubstitute( NULL, fc_bitalic, FcMatchFont);
 	FcDefaultSubstitute( fc_regular);
-	FcDefaultSubstitute( fc_bold);
-	FcDefaultSubstitute( fc_italic);
-	FcDefaultSubstitute( fc_bitalic);
-	
-	FcPatternGetDouble( fc_regular, FC_PIXEL_SIZE, 0, &pixel_size);
-	FcPatternGetDouble( fc_regular, FC_SIZE, 0, &size);
+	name = FcNameUnparse( fc_regular);
 	
-	cairo_matrix_init_scale( &font_matrix, pixel_size, pixel_size);
-	cairo_matrix_init_identity( &user_matrix);
+	/** shared with other themes or the previous reload **/
+	for( i = 0; i < FONT_CACHE_SIZE; i++ ) {
+		if( font_cache[i] && strcmp( (char*)font_cache[i]->name, (char*)name) == 0 ) {
+			stats.font_cache_hits++;
+			font_cache[i]->refs++;
+			
+			free( name);
+			FcPatternDestroy( fc_base);
+			FcPatternDestroy( fc_regular);
+			return font_cache[i];
+		}
+	}
+	stats.font_cache_misses++;
 	
-	// create regular face
-	face         = cairo_ft_font_face_create_for_pattern( fc_regular);
-	res->regular = cairo_scaled_font_create( face, &font_matrix, &user_matrix, fopts);
-	cairo_font_face_destroy( face);
+	res = (thor_font_t*)malloc( sizeof(thor_font_t));
+	memset( res, 0, sizeof(thor_font_t));
+	res->refs    = 1;
+	res->name    = name;
+	res->pattern = fc_base;
 	
-	// create bold face
-	face         = cairo_ft_font_face_create_for_pattern( fc_bold);
-	res->bold    = cairo_scaled_font_create( face, &font_matrix, &user_matrix, fopts);
-	cairo_font_face_destroy( face);
-	
-	// create italic face
-	face         = cairo_ft_font_face_create_for_pattern( fc_italic);
-	res->italic  = cairo_scaled_font_create( face, &font_matrix, &user_matrix, fopts);
-	cairo_font_face_destroy( face);
+	FcPatternGetDouble( fc_regular, FC_PIXEL_SIZE, 0, &pixel_size);
+	cairo_matrix_init_scale( &res->matrix, pixel_size, pixel_size);
 	
-	// create bold-italic face
-	face              = cairo_ft_font_face_create_for_pattern( fc_bitalic);
-	res->bold_italic  = cairo_scaled_font_create( face, &font_matrix, &user_matrix, fopts);
-	cairo_font_face_destroy( face);
+	res->face[STYLE_REGULAR] = create_face( fc_regular, &res->matrix);
 	
-	cairo_scaled_font_extents( res->regular, &res->ext);
+	cairo_scaled_font_extents( res->face[STYLE_REGULAR], &res->ext);
 	res->ul_width = round( res->ext.descent / 4);
 	res->ul_pos   = round( res->ext.descent / 2) - res->ul_width / 2;
 	
-	// clean
 	FcPatternDestroy( fc_regular);
-	FcPatternDestroy( fc_bold);
-	FcPatternDestroy( fc_italic);
-	FcPatternDestroy( fc_bitalic);
-	cairo_font_options_destroy( fopts);
+	cache_font( res);
 	
 	return res;
 };
 
 
 /*
- * Frees thor_font _t object.
+ * Gets a style of a font, creating it the first time markup asks for it.
+ * 
+ * Parameters: font  - The thor_font_t.
+ *             style - Style property flags, only bold and italic are used.
  * 
- * Parameters: font - thor_font_t to free.
+ * Returns: The scaled font of the style.
+ */
+static cairo_scaled_font_t *
+get_face( thor_font_t *font, int style)
+{
+	FcPattern *fc_style;
+	
+	
+	if( font->face[STYLE( style)] )
+		return font->face[STYLE( style)];
+	
+	fc_style = FcPatternDuplicate( font->pattern);
+	if( style & STYLE_BOLD )
+		FcPatternAddInteger( fc_style, FC_WEIGHT, FC_WEIGHT_BOLD);
+	if( style & STYLE_ITALIC )
+		FcPatternAddInteger( fc_style, FC_SLANT , FC_SLANT_ITALIC);
+	
+	FcConfigSubstitute( NULL, fc_style, FcMatchFont);
+	FcDefaultSubstitute( fc_style);
+	
+	font->face[STYLE( style)] = create_face( fc_style, &font->matrix);
+	FcPatternDestroy( fc_style);
+	
+	return font->face[STYLE( style)];
+};
+
+
+/*
+ * Releases a thor_font_t. Cached fonts stay for the next theme asking for them.
+ * 
+ * Parameters: font - thor_font_t to release.
  */
 void
 free_font( thor_font_t *font)
 {
-	if( font != NULL ) {
-		cairo_scaled_font_destroy( font->regular);
-		cairo_scaled_font_destroy( font->italic);
-		cairo_scaled_font_destroy( font->bold_italic);
-		cairo_scaled_font_destroy( font->bold);
-		
-		free( font);
+	int i;
+	
+	
+	if( font == NULL || --font->refs > 0 )
+		return;
+	
+	for( i = 0; i < FONT_CACHE_SIZE; i++ )
+		if( font_cache[i] == font )
+			return;
+	
+	destroy_font( font);
+};
+
+
+/*
+ * Makes room in the arena for laying out a string. Every line, word and
+ * fragment starts at a whitespace, newline, markup, escape or line split,
+ * and there are no more glyphs than bytes.
+ * 
+ * Parameters: text - The UTF8-string to lay out.
+ * 
+ * Returns: 0 on success, -1 on error.
+ */
+static int
+reserve_arena( char *text)
+{
+	int  len    = 0;
+	int  breaks = 0;
+	int  size;
+	
+	
+	for( ; text[len]; len++ )
+		if( text[len] == ' ' || text[len] == '\n' || text[len] == '<' || text[len] == '\\' )
+			breaks++;
+	
+	// a fragment is split at most once per glyph and once more
+	size = 2 * ( breaks + 1 ) + len + 1;
+	
+	if( size > arena.size ) {
+		thor_realloc( arena.line, text_line, size);
+		thor_realloc( arena.word, text_word, size);
+		thor_realloc( arena.frag, text_fragment, size);
+		if( !arena.line || !arena.word || !arena.frag ) {
+			thor_errlog( LOG_ERR, "Reserving text arena");
+			arena.size = 0;
+			return -1;
+		}
+		arena.size = size;
+	}
+	// advance has one entry more than glyphs, even for an empty text
+	if( len + 1 > arena.size_glyphs ) {
+		thor_realloc( arena.glyphs, cairo_glyph_t, len + 1);
+		thor_realloc( arena.advance, double, len + 2);
+		if( !arena.glyphs || !arena.advance ) {
+			thor_errlog( LOG_ERR, "Reserving text arena");
+			arena.size_glyphs = 0;
+			return -1;
+		}
+		arena.size_glyphs = len + 1;
 	}
+	arena.nglyphs = 0;
+	
+	return 0;
 };
 
 
 /*
- * Allocates a new text_line struct and returns the new element.
+ * Takes a new text_line from the arena.
  * 
  * Parameter: box - The text_box_t to which the text_line should be added.
  * 
@@ -138,18 +334,17 @@ free_font( thor_font_t *font)
 static text_line *
 alloc_line( text_box_t *box)
 {
-	int       index = box->nlines++;
+	text_line *line = &box->line[box->nlines++];
 	
 	
-	thor_realloc( box->line, text_line, box->nlines);
-	memset( &box->line[index], 0, sizeof(text_line));
+	memset( line, 0, sizeof(text_line));
 	
-	return &box->line[index];
+	return line;
 };
 
 
 /*
- * Allocates a new text_word struct and returns the new element.
+ * Takes a new text_word from the arena.
  * 
  * Parameter: box - The text_box_t to which the text_word should be added.
  * 
@@ -158,18 +353,17 @@ alloc_line( text_box_t *box)
 static text_word *
 alloc_word( text_box_t *box)
 {
-	int       index = box->nwords++;
+	text_word *word = &box->word[box->nwords++];
 	
 	
-	thor_realloc( box->word, text_word, box->nwords);
-	memset( &box->word[index], 0, sizeof(text_word));
+	memset( word, 0, sizeof(text_word));
 	
-	return &box->word[index];
+	return word;
 };
 
 
 /*
- * Allocates a new text_fragment struct and returns the new element.
+ * Takes a new text_fragment from the arena.
  * 
  * Parameter: box - The text_box_t to which the text_fragment should be added.
  * 
@@ -178,13 +372,59 @@ alloc_word( text_box_t *box)
 static text_fragment *
 alloc_frag( text_box_t *box)
 {
-	int           index = box->nfrags++;
+	text_fragment *frag = &box->frag[box->nfrags++];
 	
 	
-	thor_realloc( box->frag, text_fragment, box->nfrags);
-	memset( &box->frag[index], 0, sizeof(text_fragment));
+	memset( frag, 0, sizeof(text_fragment));
 	
-	return &box->frag[index];
+	return frag;
+};
+
+
+/*
+ * Copies a layout from the arena into one block, that is freed as a whole.
+ * 
+ * Parameters: box - text_box_t pointing into the arena.
+ * 
+ * Returns: The packed text_box_t, NULL on error.
+ */
+static text_box_t *
+pack_text( text_box_t *box)
+{
+	size_t        size = sizeof(text_box_t) + box->nfrags * sizeof(text_fragment)
+	                   + arena.nglyphs * sizeof(cairo_glyph_t)
+	                   + box->nlines * sizeof(text_line) + box->nwords * sizeof(text_word);
+	char          *block = (char*)malloc( size);
+	text_box_t    *res   = (text_box_t*)block;
+	cairo_glyph_t *glyphs;
+	int           f;
+	
+	
+	if( block == NULL ) {
+		thor_errlog( LOG_ERR, "Allocating text layout");
+		return NULL;
+	}
+	
+	// all parts are multiples of 8 bytes, except for the words at the end
+	*res       = *box;
+	block     += sizeof(text_box_t);
+	res->frag  = (text_fragment*)block;
+	block     += box->nfrags * sizeof(text_fragment);
+	glyphs     = (cairo_glyph_t*)block;
+	block     += arena.nglyphs * sizeof(cairo_glyph_t);
+	res->line  = (text_line*)block;
+	block     += box->nlines * sizeof(text_line);
+	res->word  = (text_word*)block;
+	
+	memcpy( res->frag, box->frag, box->nfrags * sizeof(text_fragment));
+	memcpy( glyphs, arena.glyphs, arena.nglyphs * sizeof(cairo_glyph_t));
+	memcpy( res->line, box->line, box->nlines * sizeof(text_line));
+	memcpy( res->word, box->word, box->nwords * sizeof(text_word));
+	
+	for( f = 0; f < res->nfrags; f++ )
+		res->frag[f].glyphs = glyphs + ( box->frag[f].glyphs - arena.glyphs );
+	
+	return res;
 };
 
 
@@ -228,17 +468,6 @@ move_word( text_word *word, text_fragment *frag, double x, double y)
 };
 
 
-#define STYLE_REGULAR      0
-#define STYLE_BOLD         (1 << 0)
-#define STYLE_ITALIC       (1 << 1)
-#define STYLE_BOLD_ITALIC  (STYLE_BOLD|STYLE_ITALIC)
-#define STYLE( var)        (var & STYLE_BOLD_ITALIC)
-#define STYLE_UNDERLINED   (1 << 2)
-#define STYLE_NEWWORD      (1 << 3)
-#define STYLE_NEWLINE      (1 << 4)
-#define STYLE_END          (1 << 5)
-
-
 /*
  * Adds a new text_fragment to a text_box_t and altering the current line, word and
  * x|y position accordingly by handling newlines, whitespaces and linesplitting.
@@ -256,35 +485,47 @@ static void
 add_fragment( text_box_t *box, text_line **line, text_word **word, int style,
               double *x, double *y, double fwidth, char *string, int len)
 {
-	text_fragment        *frag = alloc_frag( box);
+	text_fragment        *frag    = alloc_frag( box);
+	double               *advance = arena.advance;
+	double               width, head;
+	int                  g, lo, hi;
 	cairo_text_extents_t ext;
 	
 	
 	/** evaluate font-style **/
 	if( style & STYLE_UNDERLINED )
 		frag->underlined = 1;
-	if( STYLE( style) == STYLE_REGULAR )
-		frag->style = box->font->regular;
-	else if( STYLE( style) == STYLE_BOLD )
-		frag->style = box->font->bold;
-	else if( STYLE( style) == STYLE_ITALIC )
-		frag->style = box->font->italic;
-	else if( STYLE( style) == STYLE_BOLD_ITALIC )
-		frag->style = box->font->bold_italic;
+	frag->style = get_face( box->font, style);
 	
+	// cairo writes into the arena, there is room for a glyph per byte
+	frag->glyphs  = arena.glyphs + arena.nglyphs;
+	frag->nglyphs = arena.size_glyphs - arena.nglyphs;
 	cairo_scaled_font_text_to_glyphs( frag->style, *x, *y, string, len,
 	                                  &frag->glyphs, &frag->nglyphs,
 	                                  NULL, NULL, NULL);
+	if( frag->glyphs != arena.glyphs + arena.nglyphs ) {
+		if( frag->nglyphs > 0 ) {
+			thor_log( LOG_ERR, "More glyphs than bytes in text, dropping fragment.");
+			cairo_glyph_free( frag->glyphs);
+		}
+		frag->glyphs  = arena.glyphs + arena.nglyphs;
+		frag->nglyphs = 0;
+	}
+	arena.nglyphs += frag->nglyphs;
 	cairo_scaled_font_glyph_extents( frag->style, frag->glyphs, frag->nglyphs, &ext);
-	frag->free_glyph = frag->glyphs;
+	width = ext.x_advance;
 	
+	/** prefix sums of the advances, cairo put every glyph at the pen position **/
+	for( g = 0; g < frag->nglyphs; g++ )
+		advance[g] = frag->glyphs[g].x - frag->glyphs[0].x;
+	advance[frag->nglyphs] = width;
 	
 	if( style & STYLE_UNDERLINED )
-			frag->underlined = ext.x_advance;
+			frag->underlined = width;
 	
 	if( fwidth > 0 ) {
 		/** split line at word boundary **/
-		if( (*x + ext.x_advance) > fwidth && (*line)->nwords ) {
+		if( (*x + width) > fwidth && (*line)->nwords ) {
 			box->width     = ( *x > box->width ) ? *x : box->width;
 			(*line)->width = *x;
 			
@@ -295,22 +536,22 @@ add_fragment( text_box_t *box, text_line **line, text_word **word, int style,
 			*x  = 0;
 		}
 		/** split line in middle of word if neccessary **/
-		while( (*x + ext.x_advance) > fwidth ) {
-			cairo_glyph_t       *hlp_glyphs = frag->glyphs;
-			int                 hlp_nglyphs = frag->nglyphs;
-			cairo_scaled_font_t *hlp_style  = frag->style;
-			int                 hlp_ul      = frag->underlined;
+		while( (*x + width) > fwidth ) {
+			text_fragment *tail;
 			
 			
-			/** evaluate break **/
-			while( (*x + ext.x_advance) > fwidth ) {
-				frag->nglyphs--;
-				cairo_scaled_font_glyph_extents( frag->style, frag->glyphs, frag->nglyphs, &ext);
+			/** evaluate break, most glyphs that still fit **/
+			lo = 0;
+			hi = frag->nglyphs;
+			while( lo < hi ) {
+				g = ( lo + hi + 1 ) / 2;
+				if( *x + advance[g] - advance[0] <= fwidth )
+					lo = g;
+				else
+					hi = g - 1;
 			}
-			*x += ext.x_advance;
-			
-			hlp_glyphs  += frag->nglyphs;
-			hlp_nglyphs -= frag->nglyphs;
+			head  = advance[lo] - advance[0];
+			*x   += head;
 			
 			box->width     = ( *x > box->width ) ? *x : box->width;
 			(*line)->width = *x;
@@ -320,24 +561,28 @@ add_fragment( text_box_t *box, text_line **line, text_word **word, int style,
 			
 			*line = alloc_line( box);
 			*word = alloc_word( box);
-			frag  = alloc_frag( box);
+			tail  = alloc_frag( box);
 			
-			frag->glyphs  = hlp_glyphs;
-			frag->nglyphs = hlp_nglyphs;
-			frag->style   = hlp_style;
-			frag->underlined = hlp_ul;
-			move_frag( frag, -*x, box->font->ext.height);
+			tail->glyphs  = frag->glyphs + lo;
+			tail->nglyphs = frag->nglyphs - lo;
+			tail->style   = frag->style;
+			frag->nglyphs = lo;
+			move_frag( tail, -*x, box->font->ext.height);
 			
-			if( style & STYLE_UNDERLINED )
-				frag->underlined = ext.x_advance;
+			width -= head;
+			if( style & STYLE_UNDERLINED ) {
+				frag->underlined = head;
+				tail->underlined = width;
+			}
 			
-			cairo_scaled_font_glyph_extents( frag->style, frag->glyphs, frag->nglyphs, &ext);
-			*x  = 0;
-			*y += box->font->ext.height;
+			frag     = tail;
+			advance += lo;
+			*x       = 0;
+			*y      += box->font->ext.height;
 		}
 	}
 	
-	*x += ext.x_advance;
+	*x += width;
 	(*word)->nfrags++;
 	
 	if( style & STYLE_NEWLINE ) {
@@ -373,7 +618,9 @@ add_fragment( text_box_t *box, text_line **line, text_word **word, int style,
  * Parameters: text - The UTF8-string to convert.
  *             font - The thor_font_t that contains the font.
  * 
- * Returns: text_box_t containing the glyphs and dimensions.
+ * Returns: text_box_t containing the glyphs and dimensions, with one reference
+ *          for the caller. It is not modified anymore, see release_text().
+ *          NULL on error.
  */
 text_box_t *
 prepare_text( char *text, thor_font_t *font, double fwidth)
@@ -383,14 +630,21 @@ prepare_text( char *text, thor_font_t *font, double fwidth)
 	int         escape = 0;
 	double      x      = 0;
 	double      y      = font->ext.ascent;
-	text_box_t  *res   = (text_box_t*)malloc( sizeof(text_box_t));
+	text_box_t  box    = {0};
+	text_box_t  *res   = &box;
 	text_line   *line;
 	text_word   *word;
 	
 	
+	if( reserve_arena( text) == -1 )
+		return NULL;
+	
 	fwidth = (fwidth > font->ext.max_x_advance) ? fwidth : 0;
-	memset( res, 0, sizeof(text_box_t));
+	res->refs = 1;
 	res->font = font;
+	res->line = arena.line;
+	res->word = arena.word;
+	res->frag = arena.frag;
 	line      = alloc_line( res);
 	word      = alloc_word( res);
 	
@@ -484,7 +738,84 @@ prepare_text( char *text, thor_font_t *font, double fwidth)
 	if( fwidth > 0 )
 		res->width = fwidth;
 	
-	return res;
+	return pack_text( res);
+};
+
+
+/*
+ * Looks up the layout of a message in the text cache or prepares it and
+ * replaces the least recently used entry.
+ * 
+ * Parameters: text   - The UTF8-string to convert.
+ *             font   - The thor_font_t that contains the font.
+ *             fwidth - Line width, that is forced upon the text.
+ * 
+ * Returns: text_box_t with a reference for the caller, see release_text().
+ *          NULL on error.
+ */
+text_box_t *
+get_text( char *text, thor_font_t *font, double fwidth)
+{
+	size_t       len    = strlen( text);
+	text_cache_t *entry = &text_cache[0];
+	text_box_t   *box;
+	int          i;
+	
+	
+	for( i = 0; i < TEXT_CACHE_SIZE; i++ ) {
+		text_cache_t *c = &text_cache[i];
+		
+		
+		if( c->message && c->len == len && c->font == font && c->fwidth == fwidth
+		 && memcmp( c->message, text, len) == 0 ) {
+			c->last_used = ++text_cache_clock;
+			stats.text_cache_hits++;
+			return ref_text( c->box);
+		}
+		
+		/** free entries first, then the oldest **/
+		if( entry->message && ( c->message == NULL || c->last_used < entry->last_used ) )
+			entry = c;
+	}
+	
+	stats.text_cache_misses++;
+	if( (box = prepare_text( text, font, fwidth)) == NULL )
+		return NULL;
+	
+	if( entry->message ) {
+		release_text( entry->box);
+		free( entry->message);
+	}
+	
+	entry->message   = strndup( text, len);
+	entry->len       = len;
+	entry->font      = font;
+	entry->fwidth    = fwidth;
+	entry->box       = box;
+	entry->last_used = ++text_cache_clock;
+	
+	return ref_text( entry->box);
+};
+
+
+/*
+ * Empties the text cache. Has to be called before the fonts of the cached
+ * layouts are freed, layouts still referenced elsewhere must not be drawn
+ * after that.
+ */
+void
+flush_text_cache()
+{
+	int i;
+	
+	
+	for( i = 0; i < TEXT_CACHE_SIZE; i++ ) {
+		if( text_cache[i].message ) {
+			release_text( text_cache[i].box);
+			free( text_cache[i].message);
+		}
+	}
+	memset( text_cache, 0, sizeof(text_cache));
 };
 
 
@@ -492,14 +823,16 @@ prepare_text( char *text, thor_font_t *font, double fwidth)
  * Draws the glyphs contained in 'text'.
  * 
  * Parameters: cr   - Cairo context.
- *             text - text_box_t containing the glyphs to show.
+ *             text - text_box_t containing the glyphs to show, stays unchanged
+ *                    and can be drawn again.
  */
 void
-draw_text( cairo_t *cr, text_box_t *text, text_t *text_theme)
+draw_text( cairo_t *cr, const text_box_t *text, text_t *text_theme)
 {
 	int l = 0;
 	int w = 0;
 	int f = 0;
+	int lw, wf;
 	cairo_matrix_t source_m, font_m;
 	
 	
@@ -511,7 +844,7 @@ draw_text( cairo_t *cr, text_box_t *text, text_t *text_theme)
 	}
 	
 	for( ; l < text->nlines; l++ ) {
-		text_line *line = &text->line[l];
+		const text_line *line = &text->line[l];
 		
 		
 		/** aligning **/
@@ -526,13 +859,13 @@ draw_text( cairo_t *cr, text_box_t *text, text_t *text_theme)
 			cairo_get_matrix( cr, &font_m);
 		}
 		
-		for( ; line->nwords; line->nwords--, w++ ) {
-			text_word *word = &text->word[w];
+		for( lw = 0; lw < line->nwords; lw++, w++ ) {
+			const text_word *word = &text->word[w];
 			
 			
-			for( ; word->nfrags; word->nfrags--, f++ ) {
-				text_fragment *frag = &text->frag[f];
-				int           i;
+			for( wf = 0; wf < word->nfrags; wf++, f++ ) {
+				const text_fragment *frag = &text->frag[f];
+				int                 i;
 				
 				
 				if( !frag->nglyphs )
@@ -572,13 +905,36 @@ draw_text( cairo_t *cr, text_box_t *text, text_t *text_theme)
 			}
 		}
 	}
+};
+
+
+/*
+ * Takes another reference to a text_box_t.
+ * 
+ * Parameters: text - The text_box_t.
+ * 
+ * Returns: text.
+ */
+text_box_t *
+ref_text( text_box_t *text)
+{
+	text->refs++;
 	
-	/** free glyphs in fragments **/
-	for( f = 0; f < text->nfrags; f++ )
-		cairo_glyph_free( text->frag[f].free_glyph);
+	return text;
+};
+
+
+/*
+ * Drops a reference to a text_box_t and frees it with the last one.
+ * 
+ * Parameters: text - text_box_t to release.
+ */
+void
+release_text( text_box_t *text)
+{
+	if( --text->refs > 0 )
+		return;
 	
-	free( text->frag);
-	free( text->word);
-	free( text->line);
+	// lines, words, fragments and glyphs share the block
 	free( text);
 };
@@ -13,12 +13,15 @@ typedef struct text_t_ text_t;
 
 #ifdef TEXT_PRIVATE
 
+#define NSTYLES  4
+
 struct thor_font
 {
-	cairo_scaled_font_t  *regular;
-	cairo_scaled_font_t  *bold;
-	cairo_scaled_font_t  *italic;
-	cairo_scaled_font_t  *bold_italic;
+	cairo_scaled_font_t  *face[NSTYLES];   // regular, bold, italic, bold-italic, NULL until used
+	FcPattern            *pattern;         // before substitution, base of the styles
+	FcChar8              *name;            // resolved pattern, key of the font cache
+	cairo_matrix_t       matrix;
+	int                  refs;
 	
 	cairo_font_extents_t ext;
 	double               ul_pos;
@@ -34,10 +37,8 @@ typedef struct
 	cairo_scaled_font_t *style;
 	double              underlined;    // basically contains x_advance value. Set to zero for no line.
 	
-	cairo_glyph_t       *glyphs;
+	cairo_glyph_t       *glyphs;       // points into the block of the text_box_t
 	int                 nglyphs;
-	
-	cairo_glyph_t       *free_glyph;   // free this pointer ONLY!
 } text_fragment;
 
 
@@ -55,8 +56,13 @@ typedef struct
 } text_line;
 
 
+/*
+ * Layout of a message. Nothing in it changes after prepare_text(), so it
+ * can be drawn any number of times until the last reference is released.
+ */
 typedef struct
 {
+	int           refs;
 	thor_font_t   *font;
 	
 	text_line     *line;
@@ -77,4 +83,8 @@ thor_font_t *init_font( char *font_name);
 void        free_font( thor_font_t *font);
 
 text_box_t  *prepare_text( char *text, thor_font_t *font, double fwidth);
-void        draw_text( cairo_t *cr, text_box_t *text, text_t *text_theme);
+text_box_t  *get_text( char *text, thor_font_t *font, double fwidth);
+void        flush_text_cache();
+void        draw_text( cairo_t *cr, const text_box_t *text, text_t *text_theme);
+text_box_t  *ref_text( text_box_t *text);
+void        release_text( text_box_t *text);
@@ -802,27 +802,38 @@ parse_theme( char *name, thor_theme *theme)
 	char *file   = get_home_config();
 	
 
-#ifndef TESTING
-	strcat( file, "/themes/");
-	strcat( file, name);
-	
-	if( (ftheme = fopen( file, "r")) == NULL ) {
-		cpycat( cpycat( file, DEFAULT_THEMES), name);
+	/** a name containing '/' is the path of a theme file **/
+	if( strchr( name, '/') != NULL ) {
+		cpycat( file, name);
 		
 		if( (ftheme = fopen( file, "r")) == NULL ) {
 			thor_ferrlog( LOG_ERR, "Opening theme '%s'", file);
 			return -1;
 		}
 	}
+	else {
+#ifndef TESTING
+		strcat( file, "/themes/");
+		strcat( file, name);
+		
+		if( (ftheme = fopen( file, "r")) == NULL ) {
+			cpycat( cpycat( file, DEFAULT_THEMES), name);
+			
+			if( (ftheme = fopen( file, "r")) == NULL ) {
+				thor_ferrlog( LOG_ERR, "Opening theme '%s'", file);
+				return -1;
+			}
+		}
 #else
-	
-	cpycat( cpycat( file, DEFAULT_THEMES), name);
 		
-	if( (ftheme = fopen( file, "r")) == NULL ) {
-		thor_ferrlog( LOG_ERR, "Opening theme '%s'", file);
-		return -1;
-	}
+		cpycat( cpycat( file, DEFAULT_THEMES), name);
+			
+		if( (ftheme = fopen( file, "r")) == NULL ) {
+			thor_ferrlog( LOG_ERR, "Opening theme '%s'", file);
+			return -1;
+		}
 #endif
+	}
 	
 	thor_log( LOG_DEBUG, "Theme file: '%s'", file);
 
@@ -865,6 +876,8 @@ free_surface( surface_t *surface)
 		}
 		free( surface->layer);
 	}
+	if( surface->border.sprite )
+		cairo_pattern_destroy( surface->border.sprite);
 };
 
 
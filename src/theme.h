@@ -29,6 +29,8 @@ typedef struct
 	unsigned int  width;
 	uint32_t color;
 	uint32_t topcolor;
+	
+	cairo_pattern_t *sprite;   // split border rendered once, see draw_border()
 } border_t;
 
 #define PATTYPE_SOLID   0
@@ -0,0 +1,310 @@
+/* ************************************************************* *\
+ * thor-bench.c                                                  *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Measures the render pipeline headlessly for a    *
+ *              set of themes and message shapes.                *
+\* ************************************************************* */
+
+
+#include <cairo/cairo.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "com.h"
+#include "config.h"
+#include "wins.h"
+#include "NotificaThor.h"
+#include "logging.h"
+
+
+#ifndef VERSION
+	#error "Define a version!"
+#endif
+
+#define BENCH_VERSION  "thor-bench "VERSION"\n"
+#define WARMUP_FRAMES  10         // not measured, fill caches first
+#define MAX_TEXT_LEN   1024
+
+#define BENCH_USAGE \
+	"usage: thor-bench [options] THEME...\n\n" \
+	"    -n FRAMES   Frames to measure per theme and message shape (default 500).\n"\
+	"    -d DIR      Writes every frame to DIR as PNG.\n"\
+	"    -h          Print this help.\n"\
+	"    -V          Print version info.\n\n"\
+	"THEME is a theme name or the path of a theme file. Results are printed\n"\
+	"as tab separated values, times in microseconds.\n"
+
+typedef struct
+{
+	const char *name;
+	uint32_t   flags;
+	const char *format;     // message, gets the frame number, NULL for none
+} bench_case_t;
+
+static const bench_case_t cases[] =
+{
+	{ "bar",        COM_NO_IMAGE,            NULL },
+	{ "image-bar",  0,                       NULL },
+	{ "short-text", COM_NO_IMAGE|COM_NO_BAR, "Volume %d%%" },
+	{ "long-text",  COM_NO_IMAGE|COM_NO_BAR,
+	  "<b>Build finished</b> after <i>%d seconds</i> with <u>3 warnings</u> in src/wins.c, "
+	  "src/drawing.c and src/text.c. The quick brown fox jumps over the lazy dog while "
+	  "<b><i>NotificaThor</i></b> keeps drawing popups, line after line, until the text "
+	  "has to be wrapped a couple of times." },
+};
+
+#define NCASES  (sizeof(cases) / sizeof(bench_case_t))
+
+/** stages, taken from the timestamps of the reply **/
+#define STAGE_LAYOUT   0
+#define STAGE_RASTER   1
+#define STAGE_PRESENT  2
+#define STAGE_TOTAL    3
+#define NSTAGES        4
+
+/** referenced by the daemon sources **/
+int xerror = 0;
+int inofd  = -1;
+
+
+/*
+ * Compares two int64_t for qsort().
+ */
+static int
+cmp_ns( const void *a, const void *b)
+{
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	
+	
+	return ( x > y ) - ( x < y );
+};
+
+
+/*
+ * Gets a percentile of sorted samples.
+ * 
+ * Parameters: samples - Sorted samples in nanoseconds.
+ *             n       - Number of samples.
+ *             p       - Percentile, 0 to 100.
+ * 
+ * Returns: The percentile in microseconds.
+ */
+static double
+percentile( int64_t *samples, int n, int p)
+{
+	return (double)samples[(n - 1) * p / 100] / 1000;
+};
+
+
+/*
+ * Writes a test image, the bench does not depend on files of the system.
+ * 
+ * Parameters: file - Filename of the PNG.
+ * 
+ * Returns: 0 on success, -1 on error.
+ */
+static int
+create_image( char *file)
+{
+	cairo_surface_t *surf = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, 64, 64);
+	cairo_t         *cr   = cairo_create( surf);
+	cairo_pattern_t *pat  = cairo_pattern_create_radial( 32, 32, 4, 32, 32, 32);
+	cairo_status_t  status;
+	
+	
+	cairo_pattern_add_color_stop_rgba( pat, 0, 1, 0.8, 0.2, 1);
+	cairo_pattern_add_color_stop_rgba( pat, 1, 0.2, 0.2, 0.2, 0);
+	cairo_set_source( cr, pat);
+	cairo_paint( cr);
+	
+	status = cairo_surface_write_to_png( surf, file);
+	cairo_pattern_destroy( pat);
+	cairo_destroy( cr);
+	cairo_surface_destroy( surf);
+	
+	if( status != CAIRO_STATUS_SUCCESS ) {
+		fprintf( stderr, "Writing '%s': %s.\n", file, cairo_status_to_string( status));
+		return -1;
+	}
+	return 0;
+};
+
+
+/*
+ * Renders one message shape with the current theme and prints the results.
+ * 
+ * Parameters: theme   - Name of the theme, for the output.
+ *             bcase   - The message shape.
+ *             frames  - Frames to measure.
+ *             image   - Image list for the message.
+ *             img_len - Length of the image list.
+ *             samples - Buffer for NSTAGES * frames samples.
+ */
+static void
+bench_case( const char *theme, const bench_case_t *bcase, int frames, char *image, ssize_t img_len,
+            int64_t *samples)
+{
+	char         text[MAX_TEXT_LEN];
+	thor_message msg;
+	int64_t      start, elapsed = 0;
+	int          i, s;
+	
+	
+	for( i = -WARMUP_FRAMES; i < frames; i++ ) {
+		memset( &msg, 0, sizeof(thor_message));
+		msg.flags        = bcase->flags;
+		msg.image        = image;
+		msg.image_len    = img_len;
+		msg.image_fd     = -1;
+		msg.reply_fd     = -1;
+		msg.bar_elements = 100;
+		msg.bar_part     = ( i + WARMUP_FRAMES ) % 101;     // every frame changes the bar
+		msg.message      = "";
+		msg.message_len  = 1;
+		if( bcase->format ) {
+			snprintf( text, MAX_TEXT_LEN, bcase->format, ( i + WARMUP_FRAMES ) % 101);
+			msg.message     = text;
+			msg.message_len = strlen( text) + 1;
+		}
+		
+		start = monotonic_ns();
+		if( show_osd( &msg) == -1 ) {
+			fprintf( stderr, "%s: '%s' could not be drawn.\n", theme, bcase->name);
+			return;
+		}
+		
+		if( i < 0 )
+			continue;
+		
+		samples[STAGE_LAYOUT  * frames + i] = msg.reply.layout    - start;
+		samples[STAGE_RASTER  * frames + i] = msg.reply.raster    - msg.reply.layout;
+		samples[STAGE_PRESENT * frames + i] = msg.reply.presented - msg.reply.raster;
+		samples[STAGE_TOTAL   * frames + i] = msg.reply.presented - start;
+		elapsed += msg.reply.presented - start;
+	}
+	
+	printf( "%s\t%s\t%d", theme, bcase->name, frames);
+	for( s = 0; s < NSTAGES; s++ ) {
+		qsort( samples + s * frames, frames, sizeof(int64_t), cmp_ns);
+		printf( "\t%.1f\t%.1f", percentile( samples + s * frames, frames, 50),
+		                        percentile( samples + s * frames, frames, 99));
+	}
+	printf( "\t%.1f\n", elapsed ? (double)frames * 1000000000 / elapsed : 0);
+	fflush( stdout);
+};
+
+
+int
+main( int argc, char *argv[])
+{
+	char    *dump_dir = NULL;
+	char    tmp_dir[] = "/tmp/thor-bench-XXXXXX";
+	char    image[FILENAME_MAX + 2];
+	ssize_t img_len;
+	int     frames    = 500;
+	int     opt, t, ret = 0;
+	int64_t *samples;
+	char    *end;
+	long    n;
+	
+	
+	while( (opt = getopt( argc, argv, "n:d:hV")) != -1 ) {
+		switch( opt ) {
+			case 'n':
+				errno = 0;
+				n     = strtol( optarg, &end, 10);
+				if( end == optarg || *end != '\0' || errno || n < 1 || n > INT_MAX / NSTAGES ) {
+					fprintf( stderr, "-n: '%s' is not a valid number of frames.\n", optarg);
+					return 1;
+				}
+				frames = n;
+				break;
+			
+			case 'd':
+				dump_dir = optarg;
+				break;
+			
+			case 'h':
+				fputs( BENCH_USAGE, stdout);
+				return 0;
+			
+			case 'V':
+				fputs( BENCH_VERSION, stdout);
+				return 0;
+			
+			default:
+				fputs( BENCH_USAGE, stderr);
+				return 1;
+		}
+	}
+	if( optind == argc ) {
+		fputs( BENCH_USAGE, stderr);
+		return 1;
+	}
+	
+	setup_logger( LOGGER_STDERR, NULL);
+	
+	/** image for the image shapes, list ends with an empty name **/
+	if( mkdtemp( tmp_dir) == NULL ) {
+		perror( "Creating temporary directory");
+		return 1;
+	}
+	snprintf( image, FILENAME_MAX, "%s/image.png", tmp_dir);
+	img_len = strlen( image) + 2;
+	image[img_len - 1] = '\0';
+	if( create_image( image) == -1 ) {
+		rmdir( tmp_dir);
+		return 1;
+	}
+	
+	samples = (int64_t*)malloc( (size_t)NSTAGES * frames * sizeof(int64_t));
+	if( samples == NULL ) {
+		perror( "Allocating samples");
+		unlink( image);
+		rmdir( tmp_dir);
+		return 1;
+	}
+	prepare_headless( dump_dir);
+	
+	printf( "theme\tcase\tframes"
+	        "\tlayout_p50\tlayout_p99\traster_p50\traster_p99"
+	        "\tpresent_p50\tpresent_p99\ttotal_p50\ttotal_p99\tfps\n");
+	
+	for( t = optind; t < argc; t++ ) {
+		const char *name = strrchr( argv[t], '/') ? strrchr( argv[t], '/') + 1 : argv[t];
+		int        c;
+		
+		
+		if( strlen( argv[t]) > MAX_THEME_LEN ) {
+			fprintf( stderr, "Theme '%s' is longer than %d characters.\n", argv[t], MAX_THEME_LEN);
+			ret = 1;
+			continue;
+		}
+		strcpy( config_default_theme, argv[t]);
+		if( parse_default_theme() == -1 ) {
+			fprintf( stderr, "Theme '%s' could not be read, skipping it.\n", argv[t]);
+			ret = 1;
+			continue;
+		}
+		
+		for( c = 0; c < NCASES; c++ )
+			bench_case( name, &cases[c], frames, image, img_len, samples);
+	}
+	
+	cleanup_x();
+	free( samples);
+	unlink( image);
+	rmdir( tmp_dir);
+	close_logger();
+	
+	return ret;
+};
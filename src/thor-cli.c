@@ -9,16 +9,17 @@
 \* ************************************************************* */
 
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <getopt.h>
-#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "com.h"
+#include "thor.h"
 
 
 #ifndef VERSION
@@ -26,29 +27,54 @@
 #endif
 
 #define VERSION_STRING "thor-cli "VERSION"\n"
+#define MAX_LINE_ARGS  64
+
 #define USAGE \
 	"usage: thor-cli [options]\n\n" \
 	"    -t, --timeout   Timeout for the popup.\n"\
 	"    -b, --bar       The state of the bar in form of a fraction ( e.g. \"1/2\").\n"\
 	"    -i, --image     Sends filenames of images to NotificaThor.\n"\
+	"        --image-raw Reads a WIDTHxHEIGHT image of premultiplied ARGB32 pixels from stdin.\n"\
 	"    -m, --message   Sends message string to NotificaThor.\n"\
 	"        --no-image  Suppresses the image element.\n"\
 	"        --no-bar    Suppresses the bar element.\n"\
+	"    -r, --id        Replaces queued updates carrying the same id (a positive number).\n"\
+	"        --stats     Prints the counters of NotificaThor.\n"\
+	"        --stream    Reads one set of options per line from stdin and sends each\n"\
+	"                    as a message over a single connection.\n"\
+	"        --wait      Waits until the message has been drawn.\n"\
+	"        --timing    Like --wait and prints when each stage of drawing was done.\n"\
 	"    -h, --help      No clue.\n"\
 	"    -V, --version   Print version info.\n"
 	
-static const char          optstring[] = "hVt:b:i:m:";
+typedef struct
+{
+	thor_notification_t n;
+	char                *image;     // NUL-separated filenames
+	size_t              image_len;
+	int                 stats;      // --stats was given
+	int                 stream;     // --stream was given
+	int                 timing;     // --timing was given
+} cli_message_t;
+
+static const char          optstring[] = "hVt:b:i:m:r:";
 static const struct option long_opts[] =
 {
-	{ "timeout" , required_argument, NULL, 't'},
-	{ "image"   , required_argument, NULL, 'i'},
-	{ "bar"     , required_argument, NULL, 'b'},
-	{ "message" , required_argument, NULL, 'm'},
-	{ "no-image", no_argument      , NULL, '0'},
-	{ "no-bar"  , no_argument      , NULL, '1'},
-	{ "help"    , no_argument      , NULL, 'h'},
-	{ "version" , no_argument      , NULL, 'V'},
-	{ NULL      , 0                , NULL,  0 }
+	{ "timeout"  , required_argument, NULL, 't'},
+	{ "image"    , required_argument, NULL, 'i'},
+	{ "bar"      , required_argument, NULL, 'b'},
+	{ "message"  , required_argument, NULL, 'm'},
+	{ "no-image" , no_argument      , NULL, '0'},
+	{ "no-bar"   , no_argument      , NULL, '1'},
+	{ "id"       , required_argument, NULL, 'r'},
+	{ "stats"    , no_argument      , NULL, '2'},
+	{ "image-raw", required_argument, NULL, '3'},
+	{ "stream"   , no_argument      , NULL, '4'},
+	{ "wait"     , no_argument      , NULL, '5'},
+	{ "timing"   , no_argument      , NULL, '6'},
+	{ "help"     , no_argument      , NULL, 'h'},
+	{ "version"  , no_argument      , NULL, 'V'},
+	{ NULL       , 0                , NULL,  0 }
 };
 
 
@@ -62,17 +88,17 @@ cpycat( char* dst, char* src)
 
 
 static int
-parse_bar_progress( char *string, thor_message *msg)
+parse_bar_progress( char *string, thor_notification_t *n)
 {
 	char *endptr;
 	
 	
-	msg->bar_part = strtol( string, &endptr, 10);
+	n->bar_part = strtol( string, &endptr, 10);
 	if( *endptr != '/' )
 		return -1;
 	
 	string = endptr + 1;
-	msg->bar_elements = strtol( string, &endptr, 10);
+	n->bar_elements = strtol( string, &endptr, 10);
 	if( *endptr != 0 )
 		return -1;
 	
@@ -80,128 +106,412 @@ parse_bar_progress( char *string, thor_message *msg)
 };
 
 
-int
-main( int argc, char *argv[])
+/*
+ * Reads an image of premultiplied ARGB32 pixels from stdin
+ * into a sealed memfd.
+ * 
+ * Parameters: string - Dimensions in form of "WIDTHxHEIGHT".
+ *             n      - Notification to fill in.
+ * 
+ * Returns: The memfd, -1 on error.
+ */
+static int
+read_raw_image( char *string, thor_notification_t *n)
 {
-	char               opt;
-	int                sockfd;
-	struct sockaddr_un saddr;
-	thor_message       msg = {0};
-	char               *env;
-	ssize_t            image_len_tmp = 0;
+	char    *endptr;
+	void    *data;
+	size_t  size, fill = 0;
+	ssize_t ret;
+	int     fd;
+	
+	
+	n->image_width = strtoul( string, &endptr, 10);
+	if( *endptr != 'x' || n->image_width == 0 )
+		return -1;
+	
+	n->image_height = strtoul( endptr + 1, &endptr, 10);
+	if( *endptr != 0 || n->image_height == 0 )
+		return -1;
+	
+	n->image_stride = n->image_width * 4;
+	size            = (size_t)n->image_stride * n->image_height;
+	
+	if( (fd = thor_image_create( n->image_width, n->image_height, &data)) == -1 ) {
+		perror( "Creating memfd");
+		return -1;
+	}
 	
+	while( fill < size && (ret = read( STDIN_FILENO, (char*)data + fill, size - fill)) > 0 )
+		fill += ret;
 	
+	if( fill < size ) {
+		fprintf( stderr, "Expected %zu bytes of pixels on stdin.\n", size);
+		return -1;
+	}
+	
+	if( thor_image_seal( fd, data) == -1 ) {
+		perror( "Sealing memfd");
+		return -1;
+	}
+	
+	return fd;
+};
+
+
+/*
+ * Parses options into a message.
+ * 
+ * Parameters: argc, argv - The options, argv[0] is skipped.
+ *             msg        - The message to fill in.
+ *             in_stream  - Options are read from a line of --stream.
+ * 
+ * Returns: 0 on success, 1 if thor-cli should exit successfully
+ *          and -1 on error.
+ */
+static int
+parse_options( int argc, char *argv[], cli_message_t *msg, int in_stream)
+{
+	char opt;
+	
+	
+	optind = 0;
 	while( (opt = getopt_long( argc, argv, optstring, long_opts, NULL)) != -1 )
 	{
 		char    *endptr;
+		double  timeout;
 		
 		switch( opt )
 		{
 			case 'h':
 				fputs( USAGE, stderr);
-				return 0;
+				return 1;
 			
 			case 'V':
 				fputs( VERSION_STRING, stderr);
-				return 0;
+				return 1;
 			
 			case 't':
-				msg.timeout = strtod( optarg, &endptr);
-				if( *endptr != '\0' ) {
+				timeout = strtod( optarg, &endptr);
+				if( *endptr != '\0' || timeout < 0 ) {
 					fprintf( stderr, "'%s' is not a valid number.\n", optarg);
-					return 1;
+					return -1;
 				}
+				msg->n.timeout = timeout;
 				break;
 			
 			case 'i':
-				msg.image_len += strlen( optarg) + 1;
-				msg.image      = (char*)realloc( msg.image, msg.image_len);
-				cpycat( msg.image + image_len_tmp, optarg);
-				image_len_tmp  = msg.image_len;
+				msg->image = (char*)realloc( msg->image, msg->image_len + strlen( optarg) + 1);
+				cpycat( msg->image + msg->image_len, optarg);
+				msg->image_len += strlen( optarg) + 1;
 				break;
 			
 			case 'b':
-				if( parse_bar_progress( optarg, &msg) == -1 ) {
+				if( parse_bar_progress( optarg, &msg->n) == -1 ) {
 					fprintf( stderr, "'%s' is not a valid expression.\n%s", optarg, USAGE);
 					return -1;
 				}
 				break;
 			
 			case 'm':
-				msg.message_len = strlen( optarg) + 1;
-				msg.message     = optarg;
+				msg->n.message = optarg;
 				break;
 			
 			case '0': // --no-image
-				msg.flags |= COM_NO_IMAGE;
+				msg->n.flags |= THOR_NO_IMAGE;
 				break;
 			
 			case '1': // --no-bar
-				msg.flags |= COM_NO_BAR;
+				msg->n.flags |= THOR_NO_BAR;
+				break;
+			
+			case '6': // --timing
+				msg->timing = 1;
+				// fall through
+			case '5': // --wait
+				msg->n.flags |= THOR_WAIT;
+				break;
+			
+			case 'r':
+				msg->n.id = strtoul( optarg, &endptr, 10);
+				if( *endptr != '\0' || msg->n.id == 0 ) {
+					fprintf( stderr, "'%s' is not a valid id.\n", optarg);
+					return -1;
+				}
+				break;
+			
+			case '2': // --stats
+			case '4': // --stream
+				if( in_stream ) {
+					fprintf( stderr, "'%s' cannot be used in a stream.\n", argv[optind - 1]);
+					return -1;
+				}
+				if( opt == '2' )
+					msg->stats = 1;
+				else
+					msg->stream = 1;
+				break;
+			
+			case '3': // --image-raw
+				// stdin carries the stream
+				if( in_stream ) {
+					fprintf( stderr, "'%s' cannot be used in a stream.\n", argv[optind - 1]);
+					return -1;
+				}
+				if( msg->n.image_fd != -1 )
+					close( msg->n.image_fd);
+				if( (msg->n.image_fd = read_raw_image( optarg, &msg->n)) == -1 ) {
+					fprintf( stderr, "Could not read image '%s'.\n", optarg);
+					return -1;
+				}
 				break;
 		}
 	}
 	
-	msg.image_len++;
-	msg.image = (char*)realloc( msg.image, msg.image_len);
-	msg.image[msg.image_len - 1] = '\0';
+	/** terminate list of images **/
+	msg->image = (char*)realloc( msg->image, msg->image_len + 1);
+	msg->image[msg->image_len] = '\0';
+	msg->n.images = msg->image;
+	
+	return 0;
+};
+
+
+/*
+ * Splits a line into words in place, like the shell does. Words are
+ * separated by blanks, quotes group words and a backslash escapes the next
+ * character, but inside double quotes only '"' and '\'.
+ * 
+ * Parameters: line - The line to split, without the newline.
+ *             argv - Array to store the words in, argv[0] is left alone.
+ * 
+ * Returns: Number of words plus one, -1 on unbalanced quotes or too many words.
+ */
+static int
+split_line( char *line, char *argv[])
+{
+	char *src = line, *dst = line;
+	int  argc = 1;
 	
-	if( (sockfd = socket( AF_UNIX, SOCK_STREAM, 0)) == -1 ) {
-		perror( "Creating socket");
-		return 1;
-	}
 	
-	env = getenv( "XDG_CACHE_HOME");
-	if( !env || !*env) {
-		env = getenv( "HOME");
+	while( 1 ) {
+		char quote = 0;
 		
-		cpycat( cpycat( saddr.sun_path, env), "/.cache/NotificaThor/socket");
+		
+		while( *src == ' ' || *src == '\t' )
+			src++;
+		if( *src == '\0' )
+			break;
+		
+		if( argc == MAX_LINE_ARGS - 1 )
+			return -1;
+		argv[argc++] = dst;
+		
+		for( ; *src && (quote || (*src != ' ' && *src != '\t')); src++ ) {
+			if( *src == quote )
+				quote = 0;
+			else if( !quote && (*src == '"' || *src == '\'') )
+				quote = *src;
+			else if( *src == '\\' && quote != '\'' && src[1] &&
+			         (!quote || src[1] == '"' || src[1] == '\\') )
+				*dst++ = *++src;
+			else
+				*dst++ = *src;
+		}
+		if( quote )
+			return -1;
+		
+		if( *src )
+			src++;
+		*dst++ = '\0';
 	}
-	else {
-		cpycat( cpycat( saddr.sun_path, env), "/NotificaThor/socket");
+	argv[argc] = NULL;
+	
+	return argc;
+};
+
+
+/*
+ * Prints the time from sending a message to each stage of drawing it.
+ * 
+ * Parameters: sent   - CLOCK_MONOTONIC in nanoseconds when the message was sent.
+ *             timing - Reply of the daemon.
+ */
+static void
+print_timing( int64_t sent, thor_timing_t *timing)
+{
+	const char *status[] = { "shown", "replaced", "failed" };
+	uint64_t   stamp[]   = { timing->received, timing->layout, timing->raster, timing->presented };
+	const char *stage[]  = { "received", "layout", "raster", "presented" };
+	int        i;
+	
+	
+	printf( "status    %s\n", ( timing->status <= THOR_FAILED ) ? status[timing->status] : "unknown");
+	for( i = 0; i < 4; i++ ) {
+		if( stamp[i] )
+			printf( "%-9s %.3f ms\n", stage[i], (double)((int64_t)stamp[i] - sent) / 1000000);
 	}
-	saddr.sun_family = AF_UNIX;
+	fflush( stdout);
+};
+
+
+/*
+ * Sends a message, waits for the reply if asked to and reports errors.
+ * 
+ * Parameters: client - Connection to NotificaThor.
+ *             msg    - The message.
+ * 
+ * Returns: 0 on success, 1 if the message could not be drawn
+ *          and -1 on error.
+ */
+static int
+send_message( thor_client_t *client, cli_message_t *msg)
+{
+	struct timespec ts;
+	thor_timing_t   timing;
 	
-	if( connect( sockfd, (struct sockaddr*)&saddr, sizeof(struct sockaddr_un)) == -1 ) {
-		perror( "Connecting to server");
-		return 1;
+	
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	
+	if( thor_send( client, &msg->n) == -1 ) {
+		if( errno == EMSGSIZE )
+			fputs( "Images and message are too long.\n", stderr);
+		else
+			perror( "Sending message");
+		return -1;
 	}
 	
-	if( write( sockfd, &msg, sizeof(thor_message)) == -1 ) {
-		perror( "Sending message");
-		return 1;
+	if( !(msg->n.flags & THOR_WAIT) )
+		return 0;
+	
+	if( thor_wait( client, &timing) == -1 ) {
+		perror( "Waiting for reply");
+		return -1;
 	}
 	
-	if( msg.image_len > 0  || msg.message_len > 0 ) {
-		char    ack = 0;
-		char    *buffer;
-		ssize_t len = msg.image_len + msg.message_len;
+	if( msg->timing )
+		print_timing( (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, &timing);
+	
+	return ( timing.status == THOR_FAILED ) ? 1 : 0;
+};
+
+
+/*
+ * Sends one message per line of stdin over a single session
+ * until EOF. Lines that cannot be parsed are skipped. Lines that only
+ * update the bar are published to a shared memory ring instead, if the
+ * daemon provides one.
+ * 
+ * Parameters: client - Connection to NotificaThor.
+ *             base   - Options given on the command line, used as defaults
+ *                      for every line except for images.
+ * 
+ * Returns: 0 on success, -1 if the connection broke.
+ */
+static int
+stream_messages( thor_client_t *client, cli_message_t *base)
+{
+	char    *line = NULL;
+	size_t  size  = 0;
+	ssize_t len;
+	char    *args[MAX_LINE_ARGS] = { "thor-cli" };
+	int     ret   = 0;
+	int     ring_failed = 0;
+	
+	thor_ring_t *ring = NULL;
+	
+	
+	while( (len = getline( &line, &size, stdin)) != -1 ) {
+		cli_message_t msg = *base;
+		int           nargs, bar_only;
 		
 		
-		if( read( sockfd, &ack, 1) == -1 ) {
-			perror( "Receiving acknowledge");
-			return 1;
+		if( len > 0 && line[len - 1] == '\n' )
+			line[len - 1] = '\0';
+		
+		if( (nargs = split_line( line, args)) == -1 ) {
+			fprintf( stderr, "Could not split '%s'.\n", line);
+			continue;
 		}
+		if( nargs == 1 )
+			continue;
 		
-		if( ack != MSG_ACK ) {
-			fprintf( stderr, "Protocoll error: Did not receive ACK (0x%x instead) .\n", ack);
-			return 1;
+		msg.image     = NULL;
+		msg.image_len = 0;
+		
+		if( parse_options( nargs, args, &msg, 1) != 0 ) {
+			free( msg.image);
+			continue;
 		}
 		
-		buffer = (char*)malloc( len);
-		memcpy( buffer, msg.image, msg.image_len);
-		memcpy( buffer + msg.image_len, msg.message, msg.message_len);
+		/** bar updates skip the socket **/
+		bar_only = !*msg.image && msg.n.message == NULL && !(msg.n.flags & THOR_WAIT);
+		if( bar_only && ring == NULL && !ring_failed && (ring = thor_ring_open( NULL)) == NULL )
+			ring_failed = 1;
+		
+		if( bar_only && ring )
+			thor_ring_publish( ring, &msg.n);
+		else if( send_message( client, &msg) == -1 )
+			ret = -1;
+		free( msg.image);
+		
+		if( ret == -1 )
+			break;
+	}
+	
+	free( line);
+	if( ring )
+		thor_ring_close( ring);
+	
+	return ret;
+};
+
+
+int
+main( int argc, char *argv[])
+{
+	thor_client_t *client;
+	int           ret;
+	cli_message_t msg = { THOR_NOTIFICATION_INIT, NULL, 0, 0, 0 };
+	
+	
+	if( (ret = parse_options( argc, argv, &msg, 0)) != 0 )
+		return ( ret == 1 ) ? 0 : 1;
+	
+	/** print counters of the daemon **/
+	if( msg.stats ) {
+		char buffer[1024];
+		
 		
-		if( write( sockfd, buffer, len) == -1 ) {
-			perror( "Sending string");
+		if( msg.stream || msg.n.image_fd != -1 ) {
+			fputs( "'--stats' cannot be combined with '--stream' or '--image-raw'.\n", stderr);
+			return 1;
+		}
+		if( thor_stats( NULL, buffer, sizeof(buffer)) == -1 ) {
+			perror( "Querying counters");
 			return 1;
 		}
+		fputs( buffer, stdout);
 		
-		if( msg.image_len > 0 )
-			free( msg.image);
-		free( buffer);
+		return 0;
 	}
 	
-	return 0;
-};
+	if( msg.stream && msg.n.image_fd != -1 ) {
+		fputs( "'--stream' cannot be combined with '--image-raw'.\n", stderr);
+		return 1;
+	}
 	
+	if( (client = thor_connect( NULL)) == NULL ) {
+		perror( "Connecting to server");
+		return 1;
+	}
+	
+	if( msg.stream )
+		ret = stream_messages( client, &msg);
+	else
+		ret = send_message( client, &msg);
+	
+	thor_close( client);
+	free( msg.image);
+	
+	return ( ret == 0 ) ? 0 : 1;
+};
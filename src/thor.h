@@ -0,0 +1,102 @@
+/* ************************************************************* *\
+ * thor.h                                                        *
+ *                                                               *
+ * Project:     NotificaThor                                     *
+ * Author:      Christian Weber (ChristianWeber802@gmx.net)      *
+ *                                                               *
+ * Description: Client library for sending notifications to      *
+ *              NotificaThor without spawning thor-cli.          *
+\* ************************************************************* */
+
+
+#ifndef THOR_H
+#define THOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * A thor_client_t keeps one connection to the daemon open. If the daemon
+ * restarts, the next send reconnects and sends the message again.
+ * A client must not be used by several threads at once.
+ */
+typedef struct thor_client_ thor_client_t;
+
+/*
+ * A thor_ring_t is a shared memory ring for bar updates on a connection of
+ * its own. Publishing never blocks and makes a syscall only when the daemon
+ * is idle, a burst of updates is drawn as its latest one. Only flags,
+ * timeout, bar and id of a notification are carried.
+ */
+typedef struct thor_ring_ thor_ring_t;
+
+#define THOR_NO_IMAGE  (1 << 1)
+#define THOR_NO_BAR    (1 << 2)
+#define THOR_WAIT      (1 << 8)     // the daemon replies once the message is drawn, see thor_wait()
+
+typedef struct
+{
+	unsigned int flags;         // THOR_NO_IMAGE, THOR_NO_BAR, THOR_WAIT
+	double       timeout;       // seconds, 0 for default
+	unsigned int bar_part;
+	unsigned int bar_elements;
+	unsigned int id;            // a newer message with the same id replaces a queued one, 0 for none
+	const char   *images;       // filenames, each followed by '\0', ending with "\0", NULL for none
+	const char   *message;      // NULL for none
+	int          image_fd;      // sealed memfd made by thor_image_create(), -1 for none
+	unsigned int image_width;
+	unsigned int image_height;
+	unsigned int image_stride;
+} thor_notification_t;
+
+#define THOR_NOTIFICATION_INIT  { 0, 0, 0, 0, 0, NULL, NULL, -1, 0, 0, 0 }
+
+typedef struct
+{
+	#define THOR_SHOWN     0
+	#define THOR_REPLACED  1        // a newer message with the same id was shown instead
+	#define THOR_FAILED    2
+	int          status;
+	
+	/** CLOCK_MONOTONIC in nanoseconds, 0 if the stage was not reached **/
+	uint64_t     received;
+	uint64_t     layout;
+	uint64_t     raster;
+	uint64_t     presented;
+} thor_timing_t;
+
+
+/***** connection *****/
+thor_client_t *thor_connect( const char *socket_path);
+int           thor_fd( thor_client_t *client);
+void          thor_close( thor_client_t *client);
+
+/***** sending *****/
+int thor_send( thor_client_t *client, const thor_notification_t *notification);
+int thor_send_async( thor_client_t *client, const thor_notification_t *notification);
+int thor_flush( thor_client_t *client);
+int thor_wait( thor_client_t *client, thor_timing_t *timing);
+
+/***** shared memory ring *****/
+thor_ring_t *thor_ring_open( const char *socket_path);
+int         thor_ring_publish( thor_ring_t *ring, const thor_notification_t *notification);
+void        thor_ring_close( thor_ring_t *ring);
+
+/***** raw images *****/
+int thor_image_create( unsigned int width, unsigned int height, void **pixels);
+int thor_image_seal( int fd, void *pixels);
+
+/***** queries *****/
+int thor_stats( const char *socket_path, char *buffer, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THOR_H */
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "logging.h"
 #include "NotificaThor.h"
@@ -134,3 +135,17 @@ get_xdg_cache()
 	
 	return ret;
 };
+
+
+/*
+ * Returns the monotonic clock in nanoseconds.
+ */
+int64_t
+monotonic_ns()
+{
+	struct timespec ts;
+	
+	
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+};
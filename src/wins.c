@@ -12,18 +12,25 @@
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-xcb.h>
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
+#include <xcb/randr.h>
 #include <xcb/shape.h>
+#include <xcb/shm.h>
 
 #define CONFIG_GRAPHICAL
 #include "cairo_guards.h"
@@ -35,22 +42,115 @@
 #include "drawing.h"
 #include "NotificaThor.h"
 #include "logging.h"
+#include "images.h"
+#include "stats.h"
 
 
+#define MAX_OUTPUTS  16
+#define SHM_TIMEOUT  1        // seconds the X server may take to read uploads from the segment
+
 typedef struct
 {
-	xcb_window_t win;     // XCB window
-	sem_t        mapped;  // value is 0 when window is unmapped and 1 if mapped
+	xcb_window_t    win;           // XCB window
+	cairo_surface_t *surf;         // surface of the window
+	cairo_t         *cr;           // paints the buffering surface to the window
+	uint32_t        cval[4];       // geometry the window was configured with
+	int             mapped;        // 1 if mapped, also while parked off-screen
+	int             fresh;         // has just been shown, needs the whole popup
+	int             parked;        // off-screen with an empty input region, see keep_mapped
+	unsigned int    shape_serial;  // input region the window has got
+	xcb_rectangle_t overlay[2];    // bar and text rectangles added to the input region
+	int             noverlay;
 } thor_window_t;
 
+typedef struct
+{
+	cairo_surface_t *buf;      // buffering surface, popups are drawn here first
+	cairo_t         *cr;
+	cairo_pattern_t *pat;      // buf as source for copying it to the window
+	xcb_shm_seg_t   shmseg;    // MIT-SHM segment holding the pixels of buf
+	void            *shmaddr;  // NULL if buf is not shared with the X server
+	int             width;
+	int             height;
+} thor_backing_t;
+
+typedef struct
+{
+	cairo_surface_t *surf;        // background and image of the popup, drawn once
+	cairo_pattern_t *pat;
+	int             valid;
+	unsigned int    generation;   // theme_generation the base was drawn with
+	uint32_t        width;
+	uint32_t        height;
+	unsigned int    image_x;
+	unsigned int    image_y;
+	uint32_t        flags;
+	char            *image;
+	ssize_t         image_len;
+	uint64_t        image_stamp;  // modification times and sizes of the image files
+	ssize_t         image_used;   // bytes of the image list taken by background and image
+	int             raw_used;     // COM_IMAGE_FD image taken by background and image
+	xcb_rectangle_t *shape;       // input region of the base, in y-x bands
+	int             nshape;
+	int             shape_size;
+	unsigned int    shape_serial; // changes whenever the computed input region differs
+} thor_base_t;
+
+#define DAMAGE_MARGIN  4      // pixels around a changed element, that are redrawn as well
+
+typedef struct
+{
+	int                   valid;       // buffering surface holds a popup drawn from this state
+	uint32_t              cval[4];
+	uint32_t              flags;
+	unsigned int          pos[4];      // image x|y, bar x|y
+	unsigned int          bar_part;
+	unsigned int          bar_elements;
+	char                  *image;
+	ssize_t               image_len;
+	uint64_t              image_stamp; // modification times and sizes of the image files
+	char                  *message;
+	ssize_t               message_len;
+	cairo_rectangle_int_t text;
+} thor_drawn_t;
+
 
 static xcb_connection_t *con;
 static xcb_screen_t     *screen;
 static xcb_visualtype_t *visual = NULL;
 static xcb_colormap_t   cmap = 0;
-static thor_window_t    osd;
+static thor_window_t    wins[MAX_OUTPUTS];    // one per output the popup is shown on
+static int              nwins = 0;            // created windows
+static int              nshown = 0;           // windows showing the current popup
+static int              shown = 0;            // 1 while a popup is shown
+static sem_t            map_notify;           // posted for every MapNotify
+static sem_t            shm_done;             // posted for every ShmCompletion
+static int              shm_pending = 0;      // uploads the X server has not completed yet
+static uint8_t          shm_event;            // first event of MIT-SHM
+static xcb_atom_t       wmtype_atom;
+static xcb_atom_t       note_atom;
+static thor_backing_t   backing = {0};
+static thor_drawn_t     drawn = {0};
+static thor_base_t      base = {0};
+static unsigned int     theme_generation = 0;
 static pthread_t        xevents;
+static int              has_shape_ext = 0;    // SHAPE is present, has_xshape also needs 'use_xshape'
 static int              has_xshape = 0;
+static int              has_mitshm = 0;
+static int              has_randr = 0;
+static uint8_t          randr_event;          // first event of RandR
+static xcb_rectangle_t  outputs[MAX_OUTPUTS]; // geometry of active CRTCs
+static int              noutputs = 0;
+static int              primary_output = 0;
+static volatile int     outputs_stale = 1;    // set by xevent_loop on RandR changes
+static int              keep_mapped = 0;
+static int              headless = 0;
+static const char       *dump_dir = NULL;
+static unsigned long    ndumps = 0;
+static unsigned int     screen_width;
+static unsigned int     screen_height;
+static uint8_t          osd_depth;
+static xcb_gcontext_t   osd_gc;
 
 static thor_theme       theme = {0};
 
@@ -66,6 +166,7 @@ xevent_loop()
 {
 	while( 1 ) {
 		xcb_generic_event_t *event = xcb_wait_for_event( con);
+		uint8_t             type;
 		
 		
 		if( xcb_connection_has_error( con) ) {
@@ -74,11 +175,22 @@ xevent_loop()
 			return;
 		}
 			
-		switch( event->response_type ) {			
+		// the high bit marks events sent by SendEvent
+		type = event->response_type & ~0x80;
+		switch( type ) {
 			case XCB_MAP_NOTIFY:
-				sem_post( &osd.mapped);
+				sem_post( &map_notify);
 				break;
 		}
+		
+		/** X server is done reading an upload from the segment **/
+		if( has_mitshm && type == shm_event + XCB_SHM_COMPLETION )
+			sem_post( &shm_done);
+		
+		/** outputs have changed, reread them before the next popup **/
+		if( has_randr && ( type == randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY ||
+		                   type == randr_event + XCB_RANDR_NOTIFY ) )
+			outputs_stale = 1;
 		free( event);
 	}
 };
@@ -93,13 +205,264 @@ query_extensions()
 	const xcb_query_extension_reply_t *qext_reply;
 	
 	
-	// SHAPE extension
-	if( config_use_xshape ) {
-		qext_reply = xcb_get_extension_data( con, &xcb_shape_id);
-		has_xshape = qext_reply->present;
-		if( !has_xshape )
+	// SHAPE extension, parked windows need it as well
+	if( config_use_xshape || config_keep_mapped ) {
+		qext_reply    = xcb_get_extension_data( con, &xcb_shape_id);
+		has_shape_ext = qext_reply->present;
+		has_xshape    = has_shape_ext && config_use_xshape;
+		if( !has_shape_ext )
 			thor_log( LOG_DEBUG, "SHAPE extension not activated.");
 	}
+	
+	// MIT-SHM extension
+	if( config_use_mitshm ) {
+		qext_reply = xcb_get_extension_data( con, &xcb_shm_id);
+		has_mitshm = qext_reply->present;
+		shm_event  = qext_reply->first_event;
+		if( !has_mitshm )
+			thor_log( LOG_DEBUG, "MIT-SHM extension not activated.");
+	}
+	
+	// RandR extension
+	qext_reply = xcb_get_extension_data( con, &xcb_randr_id);
+	if( (has_randr = qext_reply->present) ) {
+		// CRTC notifications and current screen resources need RandR 1.3
+		free( xcb_randr_query_version_reply( con, xcb_randr_query_version( con, 1, 3), NULL));
+		randr_event = qext_reply->first_event;
+		xcb_randr_select_input( con, screen->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE|
+		                                           XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE|
+		                                           XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+	}
+	else
+		thor_log( LOG_DEBUG, "RandR extension not activated, using the whole screen.");
+};
+
+
+/*
+ * Rereads the geometry of all active CRTCs. Cloned CRTCs are only kept once.
+ * Without RandR the whole screen is one output.
+ */
+static void
+refresh_outputs()
+{
+	xcb_randr_get_screen_resources_current_reply_t *res_reply = NULL;
+	xcb_randr_get_output_primary_reply_t           *pri_reply = NULL;
+	xcb_randr_get_crtc_info_cookie_t               crtc_cookie[MAX_OUTPUTS];
+	xcb_randr_crtc_t                               *crtcs;
+	int                                            ncrtcs = 0;
+	int                                            i, j, k;
+	
+	
+	outputs_stale  = 0;
+	noutputs       = 0;
+	primary_output = 0;
+	
+	if( headless || !has_randr )
+		goto whole_screen;
+	
+	res_reply = xcb_randr_get_screen_resources_current_reply( con,
+	                xcb_randr_get_screen_resources_current( con, screen->root), NULL);
+	pri_reply = xcb_randr_get_output_primary_reply( con,
+	                xcb_randr_get_output_primary( con, screen->root), NULL);
+	if( res_reply == NULL )
+		goto whole_screen;
+	
+	crtcs  = xcb_randr_get_screen_resources_current_crtcs( res_reply);
+	ncrtcs = xcb_randr_get_screen_resources_current_crtcs_length( res_reply);
+	ncrtcs = ( ncrtcs > MAX_OUTPUTS ) ? MAX_OUTPUTS : ncrtcs;
+	for( i = 0; i < ncrtcs; i++ )
+		crtc_cookie[i] = xcb_randr_get_crtc_info( con, crtcs[i], res_reply->config_timestamp);
+	
+	for( i = 0; i < ncrtcs; i++ ) {
+		xcb_randr_get_crtc_info_reply_t *crtc = xcb_randr_get_crtc_info_reply( con, crtc_cookie[i], NULL);
+		xcb_randr_output_t              *outs;
+		
+		
+		if( crtc == NULL )
+			continue;
+		if( crtc->mode == XCB_NONE || crtc->num_outputs == 0 ) {
+			free( crtc);
+			continue;
+		}
+		
+		for( j = 0; j < noutputs; j++ )
+			if( outputs[j].x == crtc->x && outputs[j].y == crtc->y &&
+			    outputs[j].width == crtc->width && outputs[j].height == crtc->height )
+				break;
+		if( j == noutputs ) {
+			outputs[j].x      = crtc->x;
+			outputs[j].y      = crtc->y;
+			outputs[j].width  = crtc->width;
+			outputs[j].height = crtc->height;
+			noutputs++;
+		}
+		
+		outs = xcb_randr_get_crtc_info_outputs( crtc);
+		for( k = 0; pri_reply && k < crtc->num_outputs; k++ )
+			if( outs[k] == pri_reply->output )
+				primary_output = j;
+		free( crtc);
+	}
+	
+  whole_screen:
+	free( res_reply);
+	free( pri_reply);
+	if( noutputs == 0 ) {
+		outputs[0].x      = 0;
+		outputs[0].y      = 0;
+		outputs[0].width  = headless ? HEADLESS_WIDTH : screen->width_in_pixels;
+		outputs[0].height = headless ? HEADLESS_HEIGHT : screen->height_in_pixels;
+		noutputs          = 1;
+	}
+	
+	/** windows are parked beyond all outputs **/
+	screen_width  = 0;
+	screen_height = 0;
+	for( i = 0; i < noutputs; i++ ) {
+		if( outputs[i].x + outputs[i].width > screen_width )
+			screen_width = outputs[i].x + outputs[i].width;
+		if( outputs[i].y + outputs[i].height > screen_height )
+			screen_height = outputs[i].y + outputs[i].height;
+	}
+	
+	#ifdef VERBOSE
+	for( i = 0; i < noutputs; i++ )
+		thor_log( LOG_DEBUG, "Output %d%s: %dx%d+%d+%d", i, ( i == primary_output ) ? " (primary)" : "",
+		          outputs[i].width, outputs[i].height, outputs[i].x, outputs[i].y);
+	#endif
+};
+
+
+/*
+ * Checks, if pixels of an ARGB32 image can be put into the window as they are.
+ * 
+ * Returns: 1 if they can, 0 if not.
+ */
+static int
+shm_format_matches()
+{
+	const xcb_setup_t     *setup = xcb_get_setup( con);
+	xcb_format_iterator_t fmt_iter;
+	uint16_t              endian = 1;
+	int                   order  = *(uint8_t*)&endian ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST;
+	
+	
+	if( setup->image_byte_order != order )
+		return 0;
+	
+	for( fmt_iter = xcb_setup_pixmap_formats_iterator( setup); fmt_iter.rem; xcb_format_next( &fmt_iter) )
+		if( fmt_iter.data->depth == osd_depth )
+			return fmt_iter.data->bits_per_pixel == 32;
+	
+	return 0;
+};
+
+
+/*
+ * Moves a window out of sight or unmaps it.
+ * 
+ * Parameters: w - The window.
+ */
+static void
+hide_window( thor_window_t *w)
+{
+	if( keep_mapped ) {
+		uint32_t pos[2] = { screen_width, screen_height };
+		
+		
+		xcb_configure_window( con, w->win, XCB_CONFIG_WINDOW_X|XCB_CONFIG_WINDOW_Y, pos);
+		w->cval[0] = pos[0];
+		w->cval[1] = pos[1];
+		
+		// an empty input region, so the parked window never takes the pointer
+		if( has_shape_ext && !w->parked ) {
+			xcb_shape_rectangles( con, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_INPUT, XCB_CLIP_ORDERING_UNSORTED,
+			                      w->win, 0, 0, 0, NULL);
+			w->shape_serial = 0;
+			w->parked       = 1;
+		}
+	}
+	else {
+		xcb_unmap_window( con, w->win);
+		w->mapped = 0;
+	}
+};
+
+
+/*
+ * Connects a window to the buffering surface.
+ * 
+ * Parameters: w - The window.
+ */
+static void
+attach_window( thor_window_t *w)
+{
+	if( w->surf ) {
+		cairo_destroy( w->cr);
+		cairo_xcb_surface_set_size( w->surf, backing.width, backing.height);
+	}
+	else
+		w->surf = cairo_xcb_surface_create( con, w->win, visual, backing.width, backing.height);
+	
+	w->cr = cairo_create( w->surf);
+	cairo_set_source( w->cr, backing.pat);
+	cairo_set_operator( w->cr, CAIRO_OPERATOR_SOURCE);
+};
+
+
+/*
+ * Creates an OSD window.
+ * 
+ * Parameters: w - Where the window is stored.
+ */
+static void
+create_window( thor_window_t *w)
+{
+	uint32_t cw_value[5];
+	#define  CW_MASK_ARGB  XCB_CW_BACK_PIXEL|XCB_CW_BORDER_PIXEL|XCB_CW_OVERRIDE_REDIRECT|\
+	                       XCB_CW_EVENT_MASK|XCB_CW_COLORMAP
+	#define  CW_MASK_RGB   XCB_CW_OVERRIDE_REDIRECT|XCB_CW_EVENT_MASK
+	
+	
+	memset( w, 0, sizeof(thor_window_t));
+	w->win = xcb_generate_id( con);
+	if( config_use_argb ) {
+		/** create argb window **/
+		cw_value[0] = 0x00000000;
+		cw_value[1] = 0xffffffff;
+		cw_value[2] = 1;
+		cw_value[3] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+		cw_value[4] = cmap;
+		xcb_create_window( con, 32, w->win, screen->root,
+	                   0, 0, 1, 1, 0, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+	                   visual->visual_id, CW_MASK_ARGB, cw_value);
+	}
+	else {
+		cw_value[0] = 1;
+		cw_value[1] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+		xcb_create_window( con, XCB_COPY_FROM_PARENT, w->win, screen->root,
+		                   0, 0, 1, 1, 0, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+		                   visual->visual_id, CW_MASK_RGB, cw_value);
+	}
+	
+	/** set _NET_WM_WINDOW_TYPE_NOTIFICATION **/
+	xcb_change_property( con, XCB_PROP_MODE_REPLACE, w->win, wmtype_atom,
+	                     XCB_ATOM_ATOM, 32, 1, &note_atom);
+	
+	/** set WM_NAME **/
+	xcb_change_property( con, XCB_PROP_MODE_REPLACE, w->win, XCB_ATOM_WM_NAME,
+	                     XCB_ATOM_STRING, 8, 12, "NotificaThor");
+	
+	/** map window once and keep it off-screen, while no popup is shown **/
+	// the caller waits for MapNotify, before anything is drawn to the window
+	if( keep_mapped ) {
+		hide_window( w);
+		xcb_map_window( con, w->win);
+		w->mapped = 1;
+	}
+	
+	if( backing.buf )
+		attach_window( w);
 };
 
 
@@ -118,11 +481,8 @@ prepare_x()
 	xcb_visualtype_iterator_t vt_iter;
 	xcb_intern_atom_cookie_t  wmtype_cookie, note_cookie;
 	xcb_intern_atom_reply_t   *wmtype_reply, *note_reply;
+	int                       i;
 	
-	uint32_t cw_value[5];
-	#define  CW_MASK_ARGB  XCB_CW_BACK_PIXEL|XCB_CW_BORDER_PIXEL|XCB_CW_OVERRIDE_REDIRECT|\
-	                       XCB_CW_EVENT_MASK|XCB_CW_COLORMAP
-	#define  CW_MASK_RGB   XCB_CW_OVERRIDE_REDIRECT|XCB_CW_EVENT_MASK
 	
 	
 	/** open display **/
@@ -194,80 +554,756 @@ prepare_x()
 		visual = vt_iter.data;
 	}
 	
-	/** create window **/
-	osd.win = xcb_generate_id( con);
-	if( config_use_argb ) {
-		/** create argb window **/
-		cw_value[0] = 0x00000000;
-		cw_value[1] = 0xffffffff;
-		cw_value[2] = 1;
-		cw_value[3] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
-		cw_value[4] = cmap;
-		xcb_create_window( con, 32, osd.win, screen->root,
-	                   0, 0, 1, 1, 0, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
-	                   visual->visual_id, CW_MASK_ARGB, cw_value);
+	osd_depth = config_use_argb ? 32 : screen->root_depth;
+	
+	/** init semaphores **/
+	sem_init( &map_notify, 0, 0);
+	sem_init( &shm_done, 0, 0);
+	
+	/** start xevent_loop thread **/
+	pthread_create( &xevents, NULL, (void*)xevent_loop, NULL);
+	
+	wmtype_reply = xcb_intern_atom_reply( con, wmtype_cookie, NULL);
+	note_reply   = xcb_intern_atom_reply( con, note_cookie  , NULL);
+	wmtype_atom  = wmtype_reply->atom;
+	note_atom    = note_reply->atom;
+	free( wmtype_reply);
+	free( note_reply);
+	
+	keep_mapped = config_keep_mapped;
+	refresh_outputs();
+	
+	/** create window for the first output, parked windows for all of them **/
+	create_window( &wins[0]);
+	nwins = 1;
+	if( keep_mapped ) {
+		for( ; nwins < noutputs && nwins < MAX_OUTPUTS; nwins++ )
+			create_window( &wins[nwins]);
+		
+		/** the only time the daemon waits for MapNotify **/
+		xcb_flush( con);
+		for( i = 0; i < nwins; i++ )
+			sem_wait( &map_notify);
 	}
+	
+	/** graphics context for MIT-SHM uploads, usable with every window **/
+	if( has_mitshm ) {
+		if( shm_format_matches() ) {
+			osd_gc = xcb_generate_id( con);
+			xcb_create_gc( con, osd_gc, wins[0].win, 0, NULL);
+		}
+		else {
+			has_mitshm = 0;
+			thor_log( LOG_DEBUG, "Pixel format of the window does not allow MIT-SHM.");
+		}
+	}
+	
+	return 0;
+};
+
+
+/*
+ * Sets up rendering without an X server. Popups are drawn to the buffering
+ * surface only and can be written to PNG files.
+ * 
+ * Parameters: dir - Directory for PNG files, NULL to not write any.
+ * 
+ * Returns: 0 on success, -1 on error.
+ */
+int
+prepare_headless( const char *dir)
+{
+	headless = 1;
+	dump_dir = dir;
+	refresh_outputs();
+	
+	thor_log( LOG_DEBUG, "Rendering headless%s%s.", dir ? " to " : "", dir ? dir : "");
+	
+	return 0;
+};
+
+
+/*
+ * Writes the buffering surface to a PNG file in dump_dir.
+ */
+static void
+dump_popup()
+{
+	char             file[FILENAME_MAX];
+	cairo_status_t   status;
+	
+	
+	snprintf( file, FILENAME_MAX, "%s/popup-%06lu.png", dump_dir, ndumps++);
+	if( (status = cairo_surface_write_to_png( backing.buf, file)) != CAIRO_STATUS_SUCCESS )
+		thor_log( LOG_ERR, "Writing '%s': %s.", file, cairo_status_to_string( status));
+};
+
+
+/*
+ * Loads the theme from rc.conf, or the built-in one if none is set.
+ * 
+ * Returns: 0 on success, -1 if the theme file could not be parsed.
+ */
+int
+parse_default_theme()
+{
+	int ret = 0;
+	
+	
+	flush_text_cache();
+	free_theme( &theme);
+	drawn.valid = 0;
+	theme_generation++;
+	
+	/** set default theme **/
+	theme.background.border.operator    = CAIRO_OPERATOR_OVER;
+	theme.image.picture.border.operator = CAIRO_OPERATOR_OVER;
+	theme.bar.empty.border.operator     = CAIRO_OPERATOR_OVER;
+	theme.bar.full.border.operator      = CAIRO_OPERATOR_OVER;
+	
+	/** parse global theme **/
+	if( *config_default_theme != '\0') {
+		ret = parse_theme( config_default_theme, &theme);
+	}
+	/** fallback **/
 	else {
-		cw_value[0] = 1;
-		cw_value[1] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
-		xcb_create_window( con, XCB_COPY_FROM_PARENT, osd.win, screen->root,
-		                   0, 0, 1, 1, 0, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
-		                   visual->visual_id, CW_MASK_RGB, cw_value);
+		theme.padtoborder_x = 15;
+		theme.padtoborder_y = 15;
+		
+		theme.bar.width     = 200;
+		theme.bar.height    = 20;
+		
+		theme.image.width   = 100;
+		theme.image.height  = 100;
+	}
+	
+	if( theme.text.font == NULL ) {
+		theme.text.font = init_font( "");
+	}
+	
+	return ret;
+};
+
+
+/*
+ * Frees the surfaces kept across popups.
+ */
+static void
+free_backing()
+{
+	if( backing.buf ) {
+		cairo_pattern_destroy( backing.pat);
+		cairo_destroy( backing.cr);
+		cairo_surface_destroy( backing.buf);
+	}
+	if( backing.shmaddr ) {
+		xcb_shm_detach( con, backing.shmseg);
+		shmdt( backing.shmaddr);
+	}
+	memset( &backing, 0, sizeof(thor_backing_t));
+};
+
+
+/*
+ * Creates a buffering surface in a shared memory segment, that is attached
+ * by the X server.
+ * 
+ * Parameters: width, height - Size of the surface.
+ * 
+ * Returns: 0 on success, -1 on error.
+ */
+static int
+create_shm_buffer( int width, int height)
+{
+	int                 stride = cairo_format_stride_for_width( CAIRO_FORMAT_ARGB32, width);
+	int                 shmid;
+	xcb_void_cookie_t   cookie;
+	xcb_generic_error_t *error;
+	
+	
+	if( (shmid = shmget( IPC_PRIVATE, stride * height, IPC_CREAT|0600)) == -1 ) {
+		thor_errlog( LOG_ERR, "Creating shared memory segment");
+		return -1;
+	}
+	backing.shmaddr = shmat( shmid, NULL, 0);
+	if( backing.shmaddr == (void*)-1 ) {
+		thor_errlog( LOG_ERR, "Attaching shared memory segment");
+		shmctl( shmid, IPC_RMID, NULL);
+		backing.shmaddr = NULL;
+		return -1;
+	}
+	
+	backing.shmseg = xcb_generate_id( con);
+	cookie         = xcb_shm_attach_checked( con, backing.shmseg, shmid, 0);
+	error          = xcb_request_check( con, cookie);
+	
+	// segment is destroyed as soon as both sides have detached it
+	shmctl( shmid, IPC_RMID, NULL);
+	if( error ) {
+		thor_log( LOG_ERR, "X server could not attach shared memory segment (error %d).",
+		          error->error_code);
+		free( error);
+		shmdt( backing.shmaddr);
+		backing.shmaddr = NULL;
+		return -1;
+	}
+	
+	backing.buf = cairo_image_surface_create_for_data( backing.shmaddr, CAIRO_FORMAT_ARGB32,
+	                                                   width, height, stride);
+	return 0;
+};
+
+
+/*
+ * Provides window and buffering surface with the size of the popup.
+ * They are only recreated when the size changes.
+ * 
+ * Parameters: width, height - Size of the popup.
+ */
+static void
+resize_backing( int width, int height)
+{
+	int i;
+	
+	
+	if( backing.buf && backing.width == width && backing.height == height )
+		return;
+	
+	free_backing();
+	
+	/** fall back to copying through the socket, if the segment cannot be shared **/
+	if( !has_mitshm || create_shm_buffer( width, height) == -1 ) {
+		if( has_mitshm ) {
+			has_mitshm = 0;
+			thor_log( LOG_ERR, "MIT-SHM not usable, copying popups through the socket.");
+		}
+		backing.buf = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, width, height);
+	}
+	backing.cr     = cairo_create( backing.buf);
+	backing.pat    = cairo_pattern_create_for_surface( backing.buf);
+	backing.width  = width;
+	backing.height = height;
+	
+	for( i = 0; i < nwins; i++ )
+		attach_window( &wins[i]);
+	
+	stats.surface_reallocs++;
+};
+
+
+/*
+ * Waits until the X server has read every upload from the segment, so the
+ * buffering surface may be drawn again. Usually the completions have long
+ * arrived when the next popup is drawn.
+ */
+static void
+wait_uploads()
+{
+	struct timespec ts;
+	
+	
+	if( shm_pending == 0 )
+		return;
+	
+	clock_gettime( CLOCK_REALTIME, &ts);
+	ts.tv_sec += SHM_TIMEOUT;
+	while( shm_pending > 0 ) {
+		if( sem_timedwait( &shm_done, &ts) == -1 ) {
+			if( errno == EINTR )
+				continue;
+			thor_log( LOG_ERR, "X server did not complete %d uploads.", shm_pending);
+			shm_pending = 0;
+			break;
+		}
+		shm_pending--;
+	}
+};
+
+
+/*
+ * Copies parts of the buffering surface to the windows. Uploads through
+ * MIT-SHM complete asynchronously, see wait_uploads().
+ * 
+ * Parameters: n    - Number of windows.
+ *             rect - Area to copy for each window, may be empty.
+ */
+static void
+upload_backing( int n, cairo_rectangle_int_t *rect)
+{
+	int64_t start = monotonic_ns();
+	int     i;
+	
+	
+	if( backing.shmaddr )
+		cairo_surface_flush( backing.buf);
+	
+	for( i = 0; i < n; i++ ) {
+		if( rect[i].width == 0 || rect[i].height == 0 )
+			continue;
+		
+		if( backing.shmaddr ) {
+			xcb_shm_put_image( con, wins[i].win, osd_gc, backing.width, backing.height,
+			                   rect[i].x, rect[i].y, rect[i].width, rect[i].height, rect[i].x, rect[i].y,
+			                   osd_depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 1, backing.shmseg, 0);
+			shm_pending++;
+			stats.shm_uploads++;
+		}
+		else {
+			cairo_rectangle( wins[i].cr, rect[i].x, rect[i].y, rect[i].width, rect[i].height);
+			cairo_fill( wins[i].cr);
+			cairo_surface_flush( wins[i].surf);
+		}
+		stats.uploads++;
+	}
+	
+	xcb_flush( con);
+	
+	stats.upload_ns += monotonic_ns() - start;
+};
+
+
+/*
+ * Grows a rectangle by a margin and crops it to the popup.
+ * 
+ * Parameters: rect   - The rectangle.
+ *             margin - Pixels to add on each side.
+ *             cval   - Geometry of the popup.
+ */
+static void
+grow_rect( cairo_rectangle_int_t *rect, int margin, uint32_t *cval)
+{
+	int x1 = rect->x + rect->width  + margin;
+	int y1 = rect->y + rect->height + margin;
+	
+	
+	rect->x = ( rect->x > margin ) ? rect->x - margin : 0;
+	rect->y = ( rect->y > margin ) ? rect->y - margin : 0;
+	x1      = ( x1 < (int)cval[2] ) ? x1 : (int)cval[2];
+	y1      = ( y1 < (int)cval[3] ) ? y1 : (int)cval[3];
+	
+	rect->width  = ( x1 > rect->x ) ? x1 - rect->x : 0;
+	rect->height = ( y1 > rect->y ) ? y1 - rect->y : 0;
+};
+
+
+/*
+ * Extends a rectangle to cover another one as well.
+ * 
+ * Parameters: dst - The rectangle to extend, may be empty.
+ *             src - The rectangle to cover, may be empty.
+ */
+static void
+unite_rect( cairo_rectangle_int_t *dst, cairo_rectangle_int_t *src)
+{
+	int x1, y1;
+	
+	
+	if( src->width == 0 || src->height == 0 )
+		return;
+	if( dst->width == 0 || dst->height == 0 ) {
+		*dst = *src;
+		return;
+	}
+	
+	x1 = ( dst->x + dst->width  > src->x + src->width  ) ? dst->x + dst->width  : src->x + src->width;
+	y1 = ( dst->y + dst->height > src->y + src->height ) ? dst->y + dst->height : src->y + src->height;
+	dst->x      = ( dst->x < src->x ) ? dst->x : src->x;
+	dst->y      = ( dst->y < src->y ) ? dst->y : src->y;
+	dst->width  = x1 - dst->x;
+	dst->height = y1 - dst->y;
+};
+
+
+/*
+ * Compares two buffers.
+ */
+static int
+same_data( char *a, ssize_t a_len, char *b, ssize_t b_len)
+{
+	return a_len == b_len && ( a_len == 0 || memcmp( a, b, a_len) == 0 );
+};
+
+
+/*
+ * Compares a message with the popup in the buffering surface.
+ * 
+ * Parameters: msg       - The new message, already laid out.
+ *             cval      - Geometry of the new popup.
+ *             text_rect - Area of the new text.
+ *             stamp     - Stamp of the image files, see stamp_images().
+ *             damage    - Pointer to where the area to redraw is stored.
+ * 
+ * Returns: 1 if the whole popup has to be redrawn, 0 if damage is enough.
+ */
+static int
+find_damage( thor_message *msg, uint32_t *cval, cairo_rectangle_int_t *text_rect, uint64_t stamp,
+             cairo_rectangle_int_t *damage)
+{
+	unsigned int pos[4] = { theme.image.x, theme.image.y, theme.bar.x, theme.bar.y };
+	
+	
+	memset( damage, 0, sizeof(cairo_rectangle_int_t));
+	
+	if( !drawn.valid || msg->image_fd != -1 ||
+	    memcmp( drawn.cval, cval, sizeof(drawn.cval)) != 0 ||
+	    memcmp( drawn.pos, pos, sizeof(drawn.pos)) != 0 ||
+	    drawn.flags != (msg->flags & (COM_NO_IMAGE|COM_NO_BAR)) ||
+	    !same_data( drawn.image, drawn.image_len, msg->image, msg->image_len) ||
+	    drawn.image_stamp != stamp )
+		return 1;
+	
+	if( !(msg->flags & COM_NO_BAR) &&
+	    (drawn.bar_part != msg->bar_part || drawn.bar_elements != msg->bar_elements) ) {
+		cairo_rectangle_int_t bar = { theme.bar.x, theme.bar.y, theme.bar.width, theme.bar.height };
+		
+		
+		grow_rect( &bar, theme.bar.empty.border.width + DAMAGE_MARGIN, cval);
+		unite_rect( damage, &bar);
+	}
+	
+	if( !same_data( drawn.message, drawn.message_len, msg->message, msg->message_len) ) {
+		unite_rect( damage, &drawn.text);
+		unite_rect( damage, text_rect);
+	}
+	
+	return 0;
+};
+
+
+/*
+ * Remembers what has been drawn to the buffering surface.
+ * 
+ * Parameters: msg       - The message.
+ *             cval      - Geometry of the popup.
+ *             text_rect - Area of the text.
+ *             stamp     - Stamp of the image files.
+ */
+static void
+remember_popup( thor_message *msg, uint32_t *cval, cairo_rectangle_int_t *text_rect, uint64_t stamp)
+{
+	// the image of a memfd cannot be compared
+	drawn.valid        = ( msg->image_fd == -1 );
+	drawn.flags        = msg->flags & (COM_NO_IMAGE|COM_NO_BAR);
+	drawn.pos[0]       = theme.image.x;
+	drawn.pos[1]       = theme.image.y;
+	drawn.pos[2]       = theme.bar.x;
+	drawn.pos[3]       = theme.bar.y;
+	drawn.bar_part     = msg->bar_part;
+	drawn.bar_elements = msg->bar_elements;
+	drawn.text         = *text_rect;
+	memcpy( drawn.cval, cval, sizeof(drawn.cval));
+	
+	drawn.image_len   = msg->image_len;
+	drawn.image_stamp = stamp;
+	thor_realloc( drawn.image, char, msg->image_len);
+	memcpy( drawn.image, msg->image, msg->image_len);
+	
+	drawn.message_len = msg->message_len;
+	thor_realloc( drawn.message, char, msg->message_len);
+	memcpy( drawn.message, msg->message, msg->message_len);
+};
+
+
+/*
+ * Draws background and image of a popup.
+ * 
+ * Parameters: cr   - Cairo context.
+ *             msg  - The message.
+ *             cval - Geometry of the popup.
+ */
+static void
+draw_static( cairo_t *cr, thor_message *msg, uint32_t *cval)
+{
+	/** draw background to buffering surface**/
+	fallback_surface.surf_color   = 0xff000000;
+	fallback_surface.surf_op      = CAIRO_OPERATOR_OVER;
+	draw_surface( cr, &theme.background, 0, 0, 0, cval[2], cval[3]);
+	draw_border( cr, &theme.background, 0, 0, 0, cval[2], cval[3]);
+	
+	
+	/** draw image to buffering surface**/
+	if( !(msg->flags & COM_NO_IMAGE) ) {
+		fallback_surface.surf_color = 0;
+		fallback_surface.surf_op    = CAIRO_OPERATOR_OVER;
+		draw_surface( cr, &theme.image.picture, 0, theme.image.x, theme.image.y,
+		              theme.image.width, theme.image.height);
+		draw_border( cr, &theme.image.picture, 0, theme.image.x, theme.image.y,
+		             theme.image.width, theme.image.height);
+	}
+};
+
+
+/*
+ * Appends a rectangle to the input region of the base.
+ */
+static void
+add_shape_rect( int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+	if( base.nshape == base.shape_size ) {
+		base.shape_size = base.shape_size ? 2 * base.shape_size : 64;
+		thor_realloc( base.shape, xcb_rectangle_t, base.shape_size);
+	}
+	base.shape[base.nshape].x      = x;
+	base.shape[base.nshape].y      = y;
+	base.shape[base.nshape].width  = width;
+	base.shape[base.nshape].height = height;
+	base.nshape++;
+};
+
+
+/*
+ * Computes the input region from the alpha channel of the base.
+ * Every row is split into runs of pixels with at least half opacity, rows
+ * with the same runs as the row above extend its rectangles.
+ * The new rectangles are appended to the old ones, shape_serial only
+ * changes if they differ, e.g. a memfd image with the same outline does
+ * not cause the region to be sent again.
+ */
+static void
+compute_shape()
+{
+	unsigned char *data;
+	int           stride, x, y, run;
+	int           old       = base.nshape;
+	int           band      = 0;     // first rectangle of the band above
+	int           band_size = 0;
+	
+	
+	// 'whole' leaves the region empty, the popup is click-through
+	if( config_use_xshape == 2 ) {
+		if( old || base.shape_serial == 0 )
+			base.shape_serial++;
+		base.nshape = 0;
+		return;
+	}
+	
+	cairo_surface_flush( base.surf);
+	data   = cairo_image_surface_get_data( base.surf);
+	stride = cairo_image_surface_get_stride( base.surf);
+	
+	for( y = 0; y < (int)base.height; y++ ) {
+		uint32_t *row   = (uint32_t*)(data + y * stride);
+		int      start  = base.nshape;
+		
+		
+		for( x = 0; x < (int)base.width; x = run ) {
+			while( x < (int)base.width && (row[x] >> 24) < 0x80 )
+				x++;
+			for( run = x; run < (int)base.width && (row[run] >> 24) >= 0x80; run++ );
+			if( run > x )
+				add_shape_rect( x, y, run - x, 1);
+		}
+		
+		/** merge with the band above, if the runs are the same **/
+		if( band_size && base.nshape - start == band_size ) {
+			int i;
+			
+			
+			for( i = 0; i < band_size; i++ )
+				if( base.shape[band + i].x != base.shape[start + i].x ||
+				    base.shape[band + i].width != base.shape[start + i].width )
+					break;
+			
+			if( i == band_size ) {
+				for( i = 0; i < band_size; i++ )
+					base.shape[band + i].height++;
+				base.nshape = start;
+				continue;
+			}
+		}
+		band      = start;
+		band_size = base.nshape - start;
+	}
+	
+	/** keep the old region, if it is the same **/
+	if( base.shape_serial && base.nshape - old == old &&
+	    memcmp( base.shape, base.shape + old, old * sizeof(xcb_rectangle_t)) == 0 ) {
+		base.nshape = old;
+		return;
+	}
+	memmove( base.shape, base.shape + old, (base.nshape - old) * sizeof(xcb_rectangle_t));
+	base.nshape -= old;
+	base.shape_serial++;
+};
+
+
+/*
+ * Combines modification time and size of every file of an image list,
+ * a file rewritten at the same path changes the result.
+ * 
+ * Parameters: list - NUL-separated filenames, ending with an empty one.
+ *             len  - Length of list.
+ * 
+ * Returns: FNV-1a hash of the stamps.
+ */
+static uint64_t
+stamp_images( char *list, ssize_t len)
+{
+	uint64_t      hash = 14695981039346656037ULL;
+	image_stamp_t stamp;
+	char          *name;
+	size_t        i;
+	
+	
+	for( name = list; name < list + len && *name; name += strlen( name) + 1 ) {
+		image_stamp( name, &stamp);
+		for( i = 0; i < sizeof(image_stamp_t); i++ ) {
+			hash ^= ((unsigned char*)&stamp)[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	
+	return hash;
+};
+
+
+/*
+ * Provides background and image of a popup. They are only drawn again if
+ * theme, geometry, image names or image files have changed.
+ * 
+ * Parameters: msg   - The message.
+ *             cval  - Geometry of the popup.
+ *             raw   - Pattern for the COM_IMAGE_FD image, NULL if none.
+ *             stamp - Stamp of the image files, see stamp_images().
+ * 
+ * Returns: Pattern of the cached base.
+ */
+static cairo_pattern_t *
+get_base( thor_message *msg, uint32_t *cval, cairo_pattern_t *raw, uint64_t stamp)
+{
+	cairo_t  *cr;
+	uint32_t flags = msg->flags & COM_NO_IMAGE;
+	
+	
+	if( base.valid && raw == NULL && base.generation == theme_generation &&
+	    base.width == cval[2] && base.height == cval[3] &&
+	    base.image_x == theme.image.x && base.image_y == theme.image.y && base.flags == flags &&
+	    base.image_len == msg->image_len && memcmp( base.image, msg->image, msg->image_len) == 0 &&
+	    base.image_stamp == stamp )
+		return base.pat;
+	
+	if( base.surf == NULL || base.width != cval[2] || base.height != cval[3] ) {
+		if( base.surf ) {
+			cairo_pattern_destroy( base.pat);
+			cairo_surface_destroy( base.surf);
+		}
+		base.surf = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, cval[2], cval[3]);
+		base.pat  = cairo_pattern_create_for_surface( base.surf);
 	}
 	
-	/** init "mapped" semaphore **/
-	sem_init( &osd.mapped, 0, 0);
+	cr = cairo_create( base.surf);
+	cairo_set_operator( cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint( cr);
 	
-	/** start xevent_loop thread **/
-	pthread_create( &xevents, NULL, (void*)xevent_loop, NULL);
+	image_string = msg->image;
+	image_raw    = raw;
+	draw_static( cr, msg, cval);
+	cairo_destroy( cr);
 	
-	/** set _NET_WM_WINDOW_TYPE_NOTIFICATION **/
-	wmtype_reply = xcb_intern_atom_reply( con, wmtype_cookie, NULL);
-	note_reply   = xcb_intern_atom_reply( con, note_cookie  , NULL);
-	xcb_change_property( con, XCB_PROP_MODE_REPLACE, osd.win, wmtype_reply->atom,
-	                     XCB_ATOM_ATOM, 32, 1, &note_reply->atom);
+	base.image_used = image_string - msg->image;
+	base.raw_used   = ( raw && image_raw == NULL );
+	image_raw       = NULL;
 	
-	/** set WM_NAME **/
-	xcb_change_property( con, XCB_PROP_MODE_REPLACE, osd.win, XCB_ATOM_WM_NAME,
-	                     XCB_ATOM_STRING, 8, 12, "NotificaThor");
+	// the pixels of a memfd may change, so they are never reused
+	base.valid       = ( raw == NULL );
+	base.generation  = theme_generation;
+	base.width       = cval[2];
+	base.height      = cval[3];
+	base.image_x     = theme.image.x;
+	base.image_y     = theme.image.y;
+	base.flags       = flags;
+	base.image_len   = msg->image_len;
+	base.image_stamp = stamp;
+	thor_realloc( base.image, char, msg->image_len);
+	memcpy( base.image, msg->image, msg->image_len);
 	
-	free( wmtype_reply);
-	free( note_reply);
+	if( has_xshape )
+		compute_shape();
 	
-	return 0;
+	stats.base_renders++;
+	
+	return base.pat;
 };
 
 
-void
-parse_default_theme()
+/*
+ * Draws all elements of a popup on top of the cached base.
+ * 
+ * Parameters: cr       - Cairo context.
+ *             msg      - The message.
+ *             text     - Prepared text of the message.
+ *             base_pat - Pattern of the cached base.
+ *             raw      - Pattern for the COM_IMAGE_FD image, NULL if none.
+ */
+static void
+draw_popup( cairo_t *cr, thor_message *msg, text_box_t *text, cairo_pattern_t *base_pat,
+            cairo_pattern_t *raw)
 {
-	free_theme( &theme);
+	// bar and text continue with the images left by background and image
+	image_string = msg->image + base.image_used;
+	image_raw    = base.raw_used ? NULL : raw;
 	
-	/** set default theme **/
-	theme.background.border.operator    = CAIRO_OPERATOR_OVER;
-	theme.image.picture.border.operator = CAIRO_OPERATOR_OVER;
-	theme.bar.empty.border.operator     = CAIRO_OPERATOR_OVER;
-	theme.bar.full.border.operator      = CAIRO_OPERATOR_OVER;
+	/** copy background and image **/
+	cairo_save( cr);
+	cairo_set_source( cr, base_pat);
+	cairo_set_operator( cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint( cr);
+	cairo_restore( cr);
 	
-	/** parse global theme **/
-	if( *config_default_theme != '\0') {
-		parse_theme( config_default_theme, &theme);
-	}
-	/** fallback **/
-	else {
-		theme.padtoborder_x = 15;
-		theme.padtoborder_y = 15;
+	/** draw bar draw to buffering surface**/
+	if( !(msg->flags & COM_NO_BAR) ) {
+		double x      = theme.bar.x;
+		double y      = theme.bar.y;
+		double width  = theme.bar.width;
+		double height = theme.bar.height;
+		int    flags;
+		double fraction = (double)msg->bar_part / msg->bar_elements;
 		
-		theme.bar.width     = 200;
-		theme.bar.height    = 20;
 		
-		theme.image.width   = 100;
-		theme.image.height  = 100;
+		if( fraction > 1 )	
+			fraction = 1;
+		
+		if( theme.bar.fill_rule == FILL_EMPTY_RELATIVE )
+			flags = CONTROL_SAVE_MATRIX|CONTROL_USE_MATRIX;
+		else
+			flags = CONTROL_NONE;
+		
+		fallback_surface.surf_color = 0;
+		draw_surface( cr, &theme.bar.empty, flags & CONTROL_SAVE_MATRIX,
+		              theme.bar.x, theme.bar.y, theme.bar.width, theme.bar.height);
+		
+		fallback_surface.surf_color = 0xffffffff;
+		fallback_surface.surf_op    = CAIRO_OPERATOR_DIFFERENCE;
+		switch( theme.bar.orientation ) {
+			case ORIENT_RIGHTLEFT:
+				x += (1 - fraction) * theme.bar.width;
+			
+			case ORIENT_LEFTRIGHT:
+				width = fraction * theme.bar.width;
+				break;
+			
+			case ORIENT_BOTTOMTOP:
+				y += (1 - fraction) * theme.bar.height;
+			
+			case ORIENT_TOPBOTTOM:
+				height = fraction * theme.bar.height;
+				break;
+		}
+		draw_surface( cr, &theme.bar.full, flags & CONTROL_USE_MATRIX, x, y, width, height);
+		draw_border( cr, &theme.bar.full, 0, x, y, width, height);
+		
+		draw_border( cr, &theme.bar.empty, 1, theme.bar.x, theme.bar.y,
+		             theme.bar.width, theme.bar.height);
+		
 	}
-	
-	if( theme.text.font == NULL ) {
-		theme.text.font = init_font( "");
+	/** draw text to buffering surface **/
+	if( msg->message_len > 1 ) {
+		fallback_surface.surf_color = 0xffffffff;
+		fallback_surface.surf_op    = CAIRO_OPERATOR_DIFFERENCE;
+		draw_text( cr, text, &theme.text);
 	}
+	
+	image_raw = NULL;
 };
 
 
@@ -291,6 +1327,62 @@ print_coords( uint32_t *cval, thor_theme *theme, text_box_t *text)
 };
 #endif
 
+/*
+ * Chooses the outputs to show a popup on, see 'osd_monitor' in rc.conf.
+ * 
+ * Parameters: targets - Pointer to where the indices of the outputs are stored.
+ * 
+ * Returns: Number of outputs.
+ */
+static int
+select_outputs( int *targets)
+{
+	int i;
+	
+	
+	// absolute coordinates name one place on the screen, one window is enough
+	if( config_osd_default_x.abs_flag && config_osd_default_y.abs_flag ) {
+		targets[0] = primary_output;
+		return 1;
+	}
+	
+	if( config_osd_monitor == OSD_MONITOR_ALL ) {
+		for( i = 0; i < noutputs; i++ )
+			targets[i] = i;
+		return noutputs;
+	}
+	
+	if( config_osd_monitor >= 0 && config_osd_monitor < noutputs )
+		targets[0] = config_osd_monitor;
+	else
+		targets[0] = primary_output;
+	
+	return 1;
+};
+
+
+/*
+ * Places a popup on an output. Absolute coordinates stay relative to the
+ * whole screen.
+ * 
+ * Parameters: cval - Geometry of the popup, x and y are set.
+ *             out  - The output.
+ */
+static void
+place_popup( uint32_t *cval, xcb_rectangle_t *out)
+{
+	if( config_osd_default_x.abs_flag )  // x
+		cval[0] = config_osd_default_x.coord;
+	else
+		cval[0] = out->x + (out->width  / 2) - ( cval[2] / 2 ) + config_osd_default_x.coord; // x
+	
+	if( config_osd_default_y.abs_flag )  // y
+		cval[1] = config_osd_default_y.coord;
+	else
+		cval[1] = out->y + (out->height / 2) - ( cval[3] / 2 ) + config_osd_default_y.coord; // y
+};
+
+
 /*
  * Maps and draws OSD.
  * 
@@ -303,9 +1395,20 @@ show_osd( thor_message *msg)
 {
 	uint32_t        cval[4]   = {0};
 	cairo_t         *cr       = NULL;
-	cairo_surface_t *surf_buf = NULL;
-	cairo_surface_t *surf_osd = NULL;
+	cairo_pattern_t *raw      = NULL;
 	text_box_t      *text     = NULL;
+	int             full;
+	uint64_t        stamp;
+	
+	int             targets[MAX_OUTPUTS];
+	int             ntargets, was_shown, i;
+	int             nmaps     = 0;
+	
+	cairo_rectangle_int_t text_rect = {0};
+	cairo_rectangle_int_t damage;
+	cairo_rectangle_int_t upload[MAX_OUTPUTS];
+	xcb_rectangle_t       overlay[2];
+	int                   noverlay  = 0;
 	
 	
 	/** stop here if there is nothing to be done **/
@@ -313,9 +1416,14 @@ show_osd( thor_message *msg)
 		thor_log( LOG_DEBUG, "No elements to be drawn.");
 		return -1;
 	}
+	
+	if( msg->message_len > 1 ) {
+		text = get_text( msg->message, theme.text.font, theme.text.width);
+		if( text == NULL )
+			return -1;
+	}
 		
-	if( msg->image_len > 0 )
-		image_string = msg->image;
+	image_string = msg->image;
 	
 	/** get custom geometry **/
 	cval[2] = 0;
@@ -336,8 +1444,6 @@ show_osd( thor_message *msg)
 			theme.bar.y += theme.padtoborder_y;
 		}
 		if( msg->message_len > 1 ) {
-			text = prepare_text( msg->message, theme.text.font, theme.text.width);
-			
 			cval[2] = ( theme.text.x + text->width  > cval[2] ) ? theme.text.x + text->width
 			                                                    : cval[2];
 			cval[3] = ( theme.text.y + text->height > cval[3] ) ? theme.text.y + text->height
@@ -370,7 +1476,6 @@ show_osd( thor_message *msg)
 			cval[3]    += theme.bar.height;
 		}
 		if( msg->message_len > 1 ) {
-			text         = prepare_text( msg->message, theme.text.font, theme.text.width);
 			if( cval[3] > theme.padtoborder_y )
 				cval[3] += 20;
 			theme.text.y = cval[3];
@@ -398,96 +1503,88 @@ show_osd( thor_message *msg)
 		#endif
 	}
 	
-	/** set osd position **/
-	if( config_osd_default_x.abs_flag )  // x
-		cval[0] = config_osd_default_x.coord;
-	else
-		cval[0] = (screen->width_in_pixels  / 2) - ( cval[2] / 2 ) + config_osd_default_x.coord; // x
-	
-	if( config_osd_default_y.abs_flag )  // y
-		cval[1] = config_osd_default_y.coord;
-	else
-		cval[1] = (screen->height_in_pixels / 2) - ( cval[3] / 2 ) + config_osd_default_y.coord; // y
+	/** set osd position on the first output **/
+	if( outputs_stale )
+		refresh_outputs();
+	ntargets = select_outputs( targets);
+	place_popup( cval, &outputs[targets[0]]);
 	
 	#ifdef VERBOSE
 	print_coords( cval, &theme, text);
 	#endif
 	
-	/** initialize cairo **/
-	surf_osd = cairo_xcb_surface_create( con, osd.win, visual, cval[2], cval[3]);
-	surf_buf = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, cval[2], cval[3]);
-	cr       = cairo_create( surf_buf);
+	msg->reply.layout = monotonic_ns();
 	
-	/** draw background to buffering surface**/
-	fallback_surface.surf_color   = 0xff000000;
-	fallback_surface.surf_op      = CAIRO_OPERATOR_OVER;
-	draw_surface( cr, &theme.background, 0, 0, 0, cval[2], cval[3]);
-	draw_border( cr, &theme.background, 0, 0, 0, cval[2], cval[3]);
+	/** wrap image sent as memfd **/
+	if( msg->image_fd != -1 && !(msg->flags & COM_NO_IMAGE) )
+		raw = get_pattern_for_memfd( msg->image_fd, msg->image_width, msg->image_height,
+		                             msg->image_stride);
 	
+	/** find out what has to be redrawn **/
+	if( msg->message_len > 1 ) {
+		text_rect.x      = theme.text.x;
+		text_rect.y      = theme.text.y;
+		text_rect.width  = ceil( text->width);
+		text_rect.height = ceil( text->height);
+		grow_rect( &text_rect, DAMAGE_MARGIN, cval);
+	}
+	stamp = stamp_images( msg->image, msg->image_len);
+	full  = find_damage( msg, cval, &text_rect, stamp, &damage);
 	
-	/** draw image to buffering surface**/
-	if( !(msg->flags & COM_NO_IMAGE) ) {
-		fallback_surface.surf_color = 0;
-		fallback_surface.surf_op    = CAIRO_OPERATOR_OVER;
-		draw_surface( cr, &theme.image.picture, 0, theme.image.x, theme.image.y,
-		              theme.image.width, theme.image.height);
-		draw_border( cr, &theme.image.picture, 0, theme.image.x, theme.image.y,
-		             theme.image.width, theme.image.height);
+	/** bar and text take input, even where background and image are transparent **/
+	if( has_xshape && config_use_xshape != 2 ) {
+		if( !(msg->flags & COM_NO_BAR) ) {
+			overlay[noverlay].x      = theme.bar.x;
+			overlay[noverlay].y      = theme.bar.y;
+			overlay[noverlay].width  = theme.bar.width;
+			overlay[noverlay].height = theme.bar.height;
+			noverlay++;
+		}
+		if( msg->message_len > 1 ) {
+			overlay[noverlay].x      = theme.text.x;
+			overlay[noverlay].y      = theme.text.y;
+			overlay[noverlay].width  = ceil( text->width);
+			overlay[noverlay].height = ceil( text->height);
+			noverlay++;
+		}
 	}
-	/** draw bar draw to buffering surface**/
-	if( !(msg->flags & COM_NO_BAR) ) {
-		double x      = theme.bar.x;
-		double y      = theme.bar.y;
-		double width  = theme.bar.width;
-		double height = theme.bar.height;
-		int    flags;
-		double fraction = (double)msg->bar_part / msg->bar_elements;
-		
+	
+	/** draw to buffering surface **/
+	wait_uploads();
+	resize_backing( cval[2], cval[3]);
+	if( full ) {
+		cr = backing.cr;
+		cairo_save( cr);
+		cairo_new_path( cr);
 		
-		if( fraction > 1 )	
-			fraction = 1;
+		draw_popup( cr, msg, text, get_base( msg, cval, raw, stamp), raw);
 		
-		if( theme.bar.fill_rule == FILL_EMPTY_RELATIVE )
-			flags = CONTROL_SAVE_MATRIX|CONTROL_USE_MATRIX;
-		else
-			flags = CONTROL_NONE;
+		// drops clip, matrix and source of this popup
+		cairo_restore( cr);
+		cairo_new_path( cr);
+	}
+	else if( damage.width > 0 ) {
+		// draw_border() resets the clip, the bounds of a subsurface stay
+		cairo_surface_t *surf_dmg = cairo_surface_create_for_rectangle( backing.buf, damage.x, damage.y,
+		                                                                damage.width, damage.height);
 		
-		fallback_surface.surf_color = 0;
-		draw_surface( cr, &theme.bar.empty, flags & CONTROL_SAVE_MATRIX,
-		              theme.bar.x, theme.bar.y, theme.bar.width, theme.bar.height);
 		
-		fallback_surface.surf_color = 0xffffffff;
-		fallback_surface.surf_op    = CAIRO_OPERATOR_DIFFERENCE;
-		switch( theme.bar.orientation ) {
-			case ORIENT_RIGHTLEFT:
-				x += (1 - fraction) * theme.bar.width;
-			
-			case ORIENT_LEFTRIGHT:
-				width = fraction * theme.bar.width;
-				break;
-			
-			case ORIENT_BOTTOMTOP:
-				y += (1 - fraction) * theme.bar.height;
-			
-			case ORIENT_TOPBOTTOM:
-				height = fraction * theme.bar.height;
-				break;
-		}
-		draw_surface( cr, &theme.bar.full, flags & CONTROL_USE_MATRIX, x, y, width, height);
-		draw_border( cr, &theme.bar.full, 0, x, y, width, height);
+		cairo_surface_set_device_offset( surf_dmg, -damage.x, -damage.y);
+		cr = cairo_create( surf_dmg);
 		
-		draw_border( cr, &theme.bar.empty, 1, theme.bar.x, theme.bar.y,
-		             theme.bar.width, theme.bar.height);
+		draw_popup( cr, msg, text, get_base( msg, cval, raw, stamp), raw);
 		
+		cairo_destroy( cr);
+		cairo_surface_destroy( surf_dmg);
+		stats.partial_redraws++;
 	}
-	/** draw text to buffering surface **/
-	if( msg->message_len > 1 ) {
-		fallback_surface.surf_color = 0xffffffff;
-		fallback_surface.surf_op    = CAIRO_OPERATOR_DIFFERENCE;
-		draw_text( cr, text, &theme.text);
-	}
+	if( text )
+		release_text( text);
 	
-	cairo_destroy( cr);
+	remember_popup( msg, cval, &text_rect, stamp);
+	if( raw )
+		cairo_pattern_destroy( raw);
+	msg->reply.raster = monotonic_ns();
 	
 	/** reset dimensions **/
 	if( theme.custom_dimensions ) {
@@ -505,56 +1602,100 @@ show_osd( thor_message *msg)
 		}
 	}
 	
-	/** wait for window to be mapped **/
-	if( sem_trywait( &osd.mapped) == -1 ) {
-		xcb_map_window( con, osd.win);
-		xcb_flush( con);
-		sem_wait( &osd.mapped);
+	/** no window to show the popup in **/
+	if( headless ) {
+		if( dump_dir )
+			dump_popup();
+		msg->reply.presented = monotonic_ns();
+		return 0;
 	}
 	
-	/** configure window x, y, width, height**/
-	xcb_configure_window( con, osd.win, 15, cval);
-	
-	/** copy buffering surface to window **/
-	cr = cairo_create( surf_osd);
-	cairo_set_source_surface( cr, surf_buf, 0, 0);
-	cairo_set_operator( cr, CAIRO_OPERATOR_SOURCE);
-	cairo_paint( cr);
-	cairo_destroy( cr);
-	
-	xcb_flush( con);
+	/** one window per output, a parked one is mapped by create_window() **/
+	for( ; nwins < ntargets; nwins++ ) {
+		create_window( &wins[nwins]);
+		if( keep_mapped )
+			nmaps++;
+	}
 	
-	/** apply SHAPE **/
-	if( has_xshape ) {
-		xcb_pixmap_t    bm_shape   = xcb_generate_id( con);
-		cairo_surface_t *surf_shape;
+	was_shown = shown;
+	if( !was_shown )
+		nshown = 0;
+	for( i = 0; i < ntargets; i++ ) {
+		thor_window_t *w = &wins[i];
 		
 		
-		xcb_create_pixmap( con, 1, bm_shape, osd.win, cval[2], cval[3]);
-		surf_shape = cairo_xcb_surface_create_for_bitmap( con, screen, bm_shape, cval[2], cval[3]);
-		cr         = cairo_create( surf_shape);
+		w->fresh = !was_shown || i >= nshown;
 		
-		/** clear bitmap (completely click-through) **/
-		cairo_set_operator( cr, CAIRO_OPERATOR_CLEAR);
-		cairo_paint( cr);
-		
-		/** use buffering surface as mask **/
-		if( config_use_xshape != 2 ) {
-			cairo_set_operator( cr, CAIRO_OPERATOR_OVER);
-			cairo_mask_surface( cr, surf_buf, 0, 0);
+		/** parked window takes input again **/
+		if( w->parked ) {
+			if( !has_xshape )
+				xcb_shape_mask( con, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_INPUT, w->win, 0, 0, XCB_NONE);
+			w->parked = 0;
+		}
+		if( !w->mapped ) {
+			xcb_map_window( con, w->win);
+			w->mapped = 1;
+			nmaps++;
 		}
 		
-		cairo_destroy( cr);
-		cairo_surface_destroy( surf_shape);
-		
-		xcb_shape_mask( con, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_INPUT, osd.win, 0, 0, bm_shape);
+		/** configure window x, y, width, height**/
+		place_popup( cval, &outputs[targets[i]]);
+		if( w->fresh || memcmp( w->cval, cval, sizeof(w->cval)) != 0 ) {
+			xcb_configure_window( con, w->win, 15, cval);
+			memcpy( w->cval, cval, sizeof(w->cval));
+		}
+	}
+	/** windows of outputs, that are not used anymore **/
+	for( ; i < nshown; i++ )
+		hide_window( &wins[i]);
+	
+	/** wait for windows to be mapped **/
+	if( nmaps ) {
+		xcb_flush( con);
+		while( nmaps-- )
+			sem_wait( &map_notify);
+	}
+	
+	for( i = 0; i < ntargets; i++ ) {
+		// an unmapped or off-screen window loses its contents
+		if( full || wins[i].fresh ) {
+			upload[i].x      = 0;
+			upload[i].y      = 0;
+			upload[i].width  = cval[2];
+			upload[i].height = cval[3];
+		}
+		/** copy only what has changed **/
+		else
+			upload[i] = damage;
+	}
+	upload_backing( ntargets, upload);
+	
+	/** apply SHAPE, only sent again when the region of the base, bar or text have changed **/
+	if( has_xshape ) {
+		for( i = 0; i < ntargets; i++ ) {
+			thor_window_t *w = &wins[i];
+			
+			
+			if( w->shape_serial == base.shape_serial && w->noverlay == noverlay &&
+			    memcmp( w->overlay, overlay, noverlay * sizeof(xcb_rectangle_t)) == 0 )
+				continue;
+			
+			xcb_shape_rectangles( con, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_INPUT, XCB_CLIP_ORDERING_YX_BANDED,
+			                      w->win, 0, 0, base.nshape, base.shape);
+			if( noverlay )
+				xcb_shape_rectangles( con, XCB_SHAPE_SO_UNION, XCB_SHAPE_SK_INPUT,
+				                      XCB_CLIP_ORDERING_UNSORTED, w->win, 0, 0, noverlay, overlay);
+			w->shape_serial = base.shape_serial;
+			w->noverlay     = noverlay;
+			memcpy( w->overlay, overlay, noverlay * sizeof(xcb_rectangle_t));
+			stats.shape_updates++;
+		}
 		xcb_flush( con);
 	}
+	msg->reply.presented = monotonic_ns();
 	
-	/** clean up **/
-	cairo_surface_destroy( surf_buf);
-	cairo_surface_destroy( surf_osd);
-	sem_post( &osd.mapped);
+	nshown = ntargets;
+	shown  = 1;
 	
 	return 0;
 };
@@ -566,8 +1707,32 @@ show_osd( thor_message *msg)
 void
 cleanup_x()
 {
-	xcb_destroy_window( con, osd.win);
-	sem_destroy( &osd.mapped);
+	int i;
+	
+	
+	free_backing();
+	if( has_mitshm )
+		xcb_free_gc( con, osd_gc);
+	if( base.surf ) {
+		cairo_pattern_destroy( base.pat);
+		cairo_surface_destroy( base.surf);
+	}
+	free( base.image);
+	free( base.shape);
+	free( drawn.image);
+	free( drawn.message);
+	if( headless )
+		return;
+	
+	for( i = 0; i < nwins; i++ ) {
+		if( wins[i].surf ) {
+			cairo_destroy( wins[i].cr);
+			cairo_surface_destroy( wins[i].surf);
+		}
+		xcb_destroy_window( con, wins[i].win);
+	}
+	sem_destroy( &map_notify);
+	sem_destroy( &shm_done);
 	pthread_cancel( xevents);
 	xcb_flush( con);
 	xcb_disconnect( con);
@@ -577,20 +1742,46 @@ cleanup_x()
 
 
 /*
- * Unmap OSD.
+ * Unmap OSD. Called by the event loop, when the popup has timed out.
  */
 int
 kill_osd()
 {
-	xcb_unmap_window( con, osd.win);
-	sem_wait( &osd.mapped);
+	int i;
+	
+	
+	if( headless || !shown )
+		return 0;
+	
+	for( i = 0; i < nshown; i++ )
+		hide_window( &wins[i]);
+	shown = 0;
 	xcb_flush( con);
 	return 0;
 };
 
 
+/** colors known without X server, values of the X11 color database **/
+static const struct
+{
+	const char *name;
+	uint32_t   rgb;
+} named_colors[] =
+{
+	{ "black",     0x000000 }, { "white",     0xffffff }, { "red",       0xff0000 },
+	{ "green",     0x00ff00 }, { "blue",      0x0000ff }, { "yellow",    0xffff00 },
+	{ "cyan",      0x00ffff }, { "magenta",   0xff00ff }, { "gray",      0xbebebe },
+	{ "grey",      0xbebebe }, { "darkgray",  0xa9a9a9 }, { "darkgrey",  0xa9a9a9 },
+	{ "lightgray", 0xd3d3d3 }, { "lightgrey", 0xd3d3d3 }, { "orange",    0xffa500 },
+	{ "purple",    0xa020f0 }, { "brown",     0xa52a2a }, { "pink",      0xffc0cb },
+	{ "navy",      0x000080 }, { "maroon",    0xb03060 }, { "darkred",   0x8b0000 },
+	{ "darkgreen", 0x006400 }, { "darkblue",  0x00008b }
+};
+
+
 /*
- * Queries the RGB values for a named color from the X Server.
+ * Queries the RGB values for a named color from the X Server. Without X
+ * server only the basic colors of named_colors are known.
  * Parameters: string - The name of the color.
  *             color  - Pointer to where the color should be stored.
  * Returns: 0 on success, -1 on error.
@@ -600,10 +1791,26 @@ alloc_named_color( char *string, uint32_t *color)
 {
 	int                            ret       = -1;
 	xcb_generic_error_t            *err      = NULL;
-	xcb_alloc_named_color_cookie_t color_ck  = xcb_alloc_named_color( con, cmap, strlen(string), string);
-	xcb_alloc_named_color_reply_t  *color_rp = xcb_alloc_named_color_reply( con, color_ck, &err);
+	xcb_alloc_named_color_cookie_t color_ck;
+	xcb_alloc_named_color_reply_t  *color_rp;
+	
 	
+	if( headless ) {
+		size_t i;
+		
+		
+		for( i = 0; i < sizeof(named_colors) / sizeof(named_colors[0]); i++ )
+			if( strcasecmp( string, named_colors[i].name) == 0 ) {
+				*color = 0xff000000 | named_colors[i].rgb;
+				return 0;
+			}
+		
+		thor_log( LOG_ERR, "Color '%s' is only known to the X server, use '#rrggbb' instead.", string);
+		return -1;
+	}
 	
+	color_ck = xcb_alloc_named_color( con, cmap, strlen(string), string);
+	color_rp = xcb_alloc_named_color_reply( con, color_ck, &err);
 	if( err == NULL ) {
 		*color = 0xff000000 |
 				 ((color_rp->exact_red / 256) << 16) |
@@ -8,10 +8,15 @@
 \* ************************************************************* */
 
 
+#define HEADLESS_WIDTH   1920     // screen size popups are placed on without X server
+#define HEADLESS_HEIGHT  1080
+
+
 int  prepare_x();
+int  prepare_headless( const char *dir);
 int  show_osd( thor_message *msg);
 int  kill_osd();
 void cleanup_x();
 void query_extensions();
-void parse_default_theme();
+int  parse_default_theme();
 int  alloc_named_color( char *string, uint32_t *color);